@@ -0,0 +1,86 @@
+/**
+ * Parameter table example for SunFounder AI Camera
+ * Tunables are kept in a table the app reads and changes, instead of
+ * sliders sent with every control frame. Only changed parameters are
+ * exchanged, and they are saved to EEPROM so they survive a reset.
+ * On AVR boards (Uno) the table is left out unless PARAM_SLOT_COUNT is
+ * set with a build flag, e.g. -DPARAM_SLOT_COUNT=4
+ */
+
+// EEPROM.h must come first: the Arduino IDE only lets the library use it
+// when the sketch includes it, otherwise setParamStorage() returns false
+#include <EEPROM.h>
+#include "SunFounder_AI_Camera.h"
+
+#define WIFI_MODE WIFI_MODE_AP
+#define SSID "AiCamera"
+#define PASSWORD "12345678"
+#define NAME "My Camera"
+#define TYPE "AiCamera"
+#define PORT "8765"
+
+/** Parameter ids, keep them when parameters are added later */
+#define PARAM_KP 0
+#define PARAM_MAX_SPEED 1
+#define PARAM_LAMP 2
+
+/** First EEPROM byte used by the table */
+#define PARAM_ADDRESS 0
+
+AiCamera aiCam = AiCamera(NAME, TYPE);
+
+float kp = 1.2;
+int16_t maxSpeed = 80;
+bool lamp = false;
+
+/**
+ * Called when the app changed a parameter, the variable already holds
+ * the new value
+ */
+void onParam(uint8_t id) {
+  Serial.print("Parameter ");
+  Serial.print(id);
+  Serial.println(" changed");
+  if (id == PARAM_LAMP) {
+    if (lamp) {
+      aiCam.lamp_on();
+    } else {
+      aiCam.lamp_off();
+    }
+  }
+}
+
+void onReceive() {
+  int16_t speed = aiCam.getSlider(REGION_D);
+  int16_t error = aiCam.getJoystick(REGION_K, JOYSTICK_X);
+  speed = constrain(speed + (int16_t)(kp * error), -maxSpeed, maxSpeed);
+  aiCam.setMeter(REGION_C, speed);
+
+  // the sketch changes a parameter itself: tell the app and save it
+  if (aiCam.getButton(REGION_E) && maxSpeed != 50) {
+    maxSpeed = 50;
+    aiCam.paramChanged(PARAM_MAX_SPEED);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  aiCam.begin(SSID, PASSWORD, WIFI_MODE, PORT);
+  aiCam.setOnReceived(onReceive);
+
+  aiCam.addParam(PARAM_KP, "Kp", &kp, 0, 10);
+  aiCam.addParam(PARAM_MAX_SPEED, "Max speed", &maxSpeed, 0, 100);
+  aiCam.addParam(PARAM_LAMP, "Lamp", &lamp);
+  // after addParam(): restores the saved values
+  if (!aiCam.setParamStorage(PARAM_ADDRESS)) {
+    Serial.println("No saved parameters, using the defaults");
+  }
+  if (lamp) {
+    aiCam.lamp_on();
+  }
+  aiCam.setOnParam(onParam);
+}
+
+void loop() {
+  aiCam.loop();
+}
@@ -0,0 +1,140 @@
+/**
+ * Stack usage example for SunFounder AI Camera
+ * Measures the deepest stack use of each public API on AVR boards (Uno),
+ * and prints the static RAM of the library.
+ * Connect the app and move the controls, the table is printed every
+ * 5 seconds with the worst case seen so far of each call.
+ */
+
+#include "SunFounder_AI_Camera.h"
+
+#define WIFI_MODE WIFI_MODE_AP
+#define SSID "AiCamera"
+#define PASSWORD "12345678"
+#define NAME "My Camera"
+#define TYPE "AiCamera"
+#define PORT "8765"
+
+AiCamera aiCam = AiCamera(NAME, TYPE);
+
+/**
+ * Calls to measure, in the order they are printed
+ */
+enum {
+  API_LOOP,
+  API_GET_SLIDER,
+  API_GET_BUTTON,
+  API_GET_JOYSTICK,
+  API_GET_DPAD,
+  API_GET_THROTTLE,
+  API_GET_SPEECH,
+  API_SET_METER,
+  API_SET_RADAR,
+  API_SET_GREYSCALE,
+  API_SET_VALUE,
+  API_SEND_DATA,
+  API_LAMP_ON,
+  API_ADD_PARAM,
+  API_SEND_BULK,
+  API_TAKE_SNAPSHOT,
+  API_PUMP,
+  API_COUNT
+};
+
+const char *const apiNames[API_COUNT] = {
+  "loop", "getSlider", "getButton", "getJoystick", "getDPad",
+  "getThrottle", "getSpeech", "setMeter", "setRadar", "setGreyscale",
+  "setValue", "sendData", "lamp_on", "addParam", "sendBulk",
+  "takeSnapshot", "pump",
+};
+uint16_t apiPeak[API_COUNT];
+bool measuring = false;
+int16_t gain = 50;
+
+/**
+ * Run a call on a freshly painted stack and keep its deepest use.
+ * Calls inside a measured call only run, painting again would reset it
+ */
+#define MEASURE(api, call)                        \
+  if (measuring) {                                \
+    call;                                         \
+  } else {                                        \
+    measuring = true;                             \
+    AiCamera::stackPaint();                       \
+    call;                                         \
+    if (AiCamera::stackPeak() > apiPeak[api]) {   \
+      apiPeak[api] = AiCamera::stackPeak();       \
+    }                                             \
+    measuring = false;                            \
+  }
+
+void onReceive() {
+  char speech[VALUE_SIZE];
+  MEASURE(API_GET_SLIDER, aiCam.getSlider(REGION_D));
+  MEASURE(API_GET_BUTTON, aiCam.getButton(REGION_E));
+  MEASURE(API_GET_JOYSTICK, aiCam.getJoystick(REGION_K, JOYSTICK_ANGLE));
+  MEASURE(API_GET_DPAD, aiCam.getDPad(REGION_K));
+  MEASURE(API_GET_THROTTLE, aiCam.getThrottle(REGION_Q));
+  MEASURE(API_GET_SPEECH, aiCam.getSpeech(REGION_I, speech, sizeof(speech)));
+  MEASURE(API_SET_METER, aiCam.setMeter(REGION_C, 20));
+  MEASURE(API_SET_RADAR, aiCam.setRadar(REGION_D, 90, 20));
+  MEASURE(API_SET_GREYSCALE, aiCam.setGreyscale(REGION_B, 100, 200, 300));
+  MEASURE(API_SET_VALUE, aiCam.setValue(REGION_G, 20));
+}
+
+/**
+ * Bulk payload made up on the fly, and a snapshot sink that drops the
+ * JPEG, so the chunks are pumped without buffers of the sketch
+ */
+size_t readPattern(uint32_t offset, uint8_t *buffer, size_t size) {
+  memset(buffer, (uint8_t)offset, size);
+  return size;
+}
+
+bool dropJpeg(uint32_t offset, const uint8_t *data, size_t size) {
+  return true;
+}
+
+void printPeaks() {
+  aiCam.printMemoryReport();
+  Serial.println(F("Deepest stack use, bytes:"));
+  for (uint8_t i = 0; i < API_COUNT; i++) {
+    Serial.print(F("  "));
+    Serial.print(apiNames[i]);
+    Serial.print(F(": "));
+    Serial.println(apiPeak[i]);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  aiCam.begin(SSID, PASSWORD, WIFI_MODE, PORT);
+  aiCam.setOnReceived(onReceive);
+  MEASURE(API_LAMP_ON, aiCam.lamp_on(0));
+  MEASURE(API_ADD_PARAM, aiCam.addParam(1, "gain", &gain, 0, 100));
+}
+
+void loop() {
+  static uint32_t printTime = 0;
+  static uint8_t turn = 0;
+  // one loop() in three is measured as a whole, with onReceive() and the
+  // automatic sendData(), one as pump() alone, and the calls in onReceive()
+  // on the third
+  turn = (turn + 1) % 3;
+  if (turn == 0) {
+    MEASURE(API_LOOP, aiCam.loop());
+  } else if (turn == 1) {
+    MEASURE(API_PUMP, aiCam.pump());
+  } else {
+    aiCam.loop();
+  }
+  if (millis() - printTime >= 5000) {
+    printTime = millis();
+    MEASURE(API_SEND_DATA, aiCam.sendData());
+    // a transfer and a snapshot running in the background, pumped above.
+    // On AVR they only run with BULK_TRANSFER and SNAPSHOT_TRANSFER set
+    MEASURE(API_SEND_BULK, aiCam.sendBulk(1024, readPattern));
+    MEASURE(API_TAKE_SNAPSHOT, aiCam.takeSnapshot(CAM_FRAMESIZE_QQVGA, CAM_QUALITY_WORST, dropJpeg));
+    printPeaks();
+  }
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Build and run the host tests against the Arduino stubs in stub/.
+# A "// build: <flags>" line in a test adds compiler flags, "// link: <libs>"
+# adds libraries.
+# Usage: sh extras/test/run.sh [test_name.cpp ...]
+cd "$(dirname "$0")"
+SRC=../../src
+OUT=${OUT:-/tmp/ai_camera_test}
+mkdir -p "$OUT"
+TESTS=${*:-test_*.cpp}
+result=0
+for t in $TESTS; do
+  flags=$(sed -n 's|^// build: ||p' "$t")
+  bin="$OUT/${t%.cpp}"
+  if ! g++ -std=gnu++11 -fpermissive -w -U__linux__ -Istub -I"$SRC" $flags \
+    stub/stub.cpp "$SRC"/*.cpp "$t" -o "$bin" -lpthread $(sed -n 's|^// link: ||p' "$t"); then
+    echo "$t: BUILD FAILED"
+    result=1
+    continue
+  fi
+  "$bin" || result=1
+done
+exit $result
@@ -0,0 +1,177 @@
+/**
+ * Minimal Arduino API for the host tests, only what the library uses.
+ * DataSerial (Serial) is a byte queue the tests fill with inject(), what
+ * the library writes goes to txlog. millis() is fakeNow, advanced by delay()
+ */
+#ifndef __ARDUINO_STUB_H__
+#define __ARDUINO_STUB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <thread>
+#include <deque>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#define PI 3.14159265358979
+#define HEX 16
+#define DEC 10
+#define PROGMEM
+class __FlashStringHelper;
+#define F(x) (reinterpret_cast<const __FlashStringHelper *>(x))
+
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline char *itoa(int value, char *buffer, int radix)
+{
+  snprintf(buffer, 12, radix == 16 ? "%x" : "%d", value);
+  return buffer;
+}
+
+inline char *utoa(unsigned value, char *buffer, int radix)
+{
+  snprintf(buffer, 12, radix == 16 ? "%x" : "%u", value);
+  return buffer;
+}
+
+inline long random(long max) { return max ? rand() % max : 0; }
+
+class String
+{
+public:
+  std::string s;
+  String() {}
+  String(const char *c) : s(c) {}
+  String(const std::string &c) : s(c) {}
+  String(int v) : s(std::to_string(v)) {}
+  String(unsigned v) : s(std::to_string(v)) {}
+  String(long v) : s(std::to_string(v)) {}
+  String(unsigned long v) : s(std::to_string(v)) {}
+  String(double v, int decimals = 2)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, v);
+    s = buffer;
+  }
+  const char *c_str() const { return s.c_str(); }
+  unsigned length() const { return s.size(); }
+  String substring(unsigned from, unsigned to) const { return s.substr(from, to - from); }
+  String substring(unsigned from) const { return s.substr(from); }
+  int indexOf(const char *c) const
+  {
+    size_t p = s.find(c);
+    return p == std::string::npos ? -1 : (int)p;
+  }
+  long toInt() const { return atol(s.c_str()); }
+  double toDouble() const { return atof(s.c_str()); }
+  bool operator==(const String &o) const { return s == o.s; }
+  String operator+(const String &o) const { return s + o.s; }
+  String operator+(const char *o) const { return s + o; }
+  friend String operator+(const char *a, const String &b) { return std::string(a) + b.s; }
+};
+
+class Print
+{
+public:
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *data, size_t size)
+  {
+    for (size_t i = 0; i < size; i++)
+    {
+      if (write(data[i]) == 0)
+      {
+        return i;
+      }
+    }
+    return size;
+  }
+  virtual int availableForWrite() { return 64; }
+  virtual void flush() {}
+  int getWriteError() { return writeError; }
+  void clearWriteError() { writeError = 0; }
+
+protected:
+  int writeError = 0;
+  void setWriteError(int error = 1) { writeError = error; }
+
+public:
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const __FlashStringHelper *s) { return print(reinterpret_cast<const char *>(s)); }
+  size_t print(const String &s) { return print(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long v, int base = DEC)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), base == HEX ? "%lx" : "%ld", v);
+    return print(buffer);
+  }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned long v, int base = DEC) { return print((long)v, base); }
+  size_t print(uint8_t v, int base = DEC) { return print((long)v, base); }
+  size_t print(double v, int decimals = 2)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, v);
+    return print(buffer);
+  }
+  template <typename T>
+  size_t println(T v) { return print(v) + print("\r\n"); }
+  template <typename T>
+  size_t println(T v, int base) { return print(v, base) + print("\r\n"); }
+  size_t println() { return print("\r\n"); }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#ifdef ARDUINO_ARCH_RP2040
+/**
+ * Fake second core: any thread other than the main one is core 1
+ */
+struct FakeRP2040
+{
+  std::thread::id main = std::this_thread::get_id();
+  int cpuid() { return std::this_thread::get_id() == main ? 0 : 1; }
+};
+extern FakeRP2040 rp2040;
+#endif
+
+#endif // __ARDUINO_STUB_H__
@@ -0,0 +1,93 @@
+/**
+ * Minimal ArduinoJson for the host tests. Values are kept as their printed
+ * text, so serializeJson() output can be matched against strings
+ */
+#ifndef __ARDUINO_JSON_STUB_H__
+#define __ARDUINO_JSON_STUB_H__
+
+#include <map>
+#include <string>
+
+struct JsonVariantStub
+{
+  std::string v = "0";
+  template <typename T>
+  JsonVariantStub &operator=(T x)
+  {
+    v = std::to_string(x);
+    return *this;
+  }
+};
+
+struct JsonStringStub
+{
+  const char *s;
+  const char *c_str() const { return s; }
+};
+
+struct JsonPairConst
+{
+  const std::pair<const std::string, JsonVariantStub> *p;
+  JsonStringStub key() const { return {p->first.c_str()}; }
+  const JsonVariantStub &value() const { return p->second; }
+};
+
+struct JsonObjectConst
+{
+  const std::map<std::string, JsonVariantStub> *m;
+  struct iterator
+  {
+    std::map<std::string, JsonVariantStub>::const_iterator i;
+    JsonPairConst operator*() const { return {&*i}; }
+    iterator &operator++()
+    {
+      ++i;
+      return *this;
+    }
+    bool operator!=(const iterator &o) const { return i != o.i; }
+  };
+  iterator begin() const { return {m->begin()}; }
+  iterator end() const { return {m->end()}; }
+};
+
+template <size_t N>
+class StaticJsonDocument
+{
+public:
+  std::map<std::string, JsonVariantStub> m;
+  JsonVariantStub &operator[](const char *key) { return m[key]; }
+  void remove(const char *key) { m.erase(key); }
+  void clear() { m.clear(); }
+  size_t memoryUsage() const { return 0; }
+  size_t size() const { return m.size(); }
+  template <typename T>
+  T as() const { return T{&m}; }
+  static constexpr size_t capacity() { return N; }
+};
+
+template <size_t N>
+size_t serializeJson(const StaticJsonDocument<N> &doc, Print &out)
+{
+  size_t n = out.print("{");
+  bool first = true;
+  for (auto &kv : doc.m)
+  {
+    if (!first)
+    {
+      n += out.print(",");
+    }
+    first = false;
+    n += out.print("\"");
+    n += out.print(kv.first.c_str());
+    n += out.print("\":");
+    n += out.print(kv.second.v.c_str());
+  }
+  return n + out.print("}");
+}
+
+inline size_t serializeJson(const JsonVariantStub &v, Print &out) { return out.print(v.v.c_str()); }
+
+template <size_t N>
+size_t measureJson(const StaticJsonDocument<N> &) { return 2; }
+
+#endif // __ARDUINO_JSON_STUB_H__
@@ -0,0 +1,85 @@
+#include "Arduino.h"
+#include "test.h"
+
+#include <chrono>
+
+HardwareSerial Serial, Serial1;
+std::deque<uint8_t> rxq;
+std::string txlog;
+unsigned long fakeNow = 0;
+int failures = 0;
+
+bool txBlocked = false;
+
+#ifdef STUB_REAL_TIME
+static uint64_t elapsed(uint64_t scale)
+{
+  static auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / scale;
+}
+
+unsigned long millis() { return elapsed(1000); }
+unsigned long micros() { return elapsed(1); }
+void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+#else
+unsigned long millis() { return fakeNow; }
+unsigned long micros() { return fakeNow * 1000; }
+void delay(unsigned long ms) { fakeNow += ms; }
+#endif
+void yield() {}
+
+int HardwareSerial::available() { return rxq.size(); }
+
+int HardwareSerial::read()
+{
+  if (rxq.empty())
+  {
+    return -1;
+  }
+  int c = rxq.front();
+  rxq.pop_front();
+  return c;
+}
+
+int HardwareSerial::peek() { return rxq.empty() ? -1 : rxq.front(); }
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  if (txBlocked)
+  {
+    setWriteError();
+    return 0;
+  }
+  txlog.push_back((char)c);
+  return 1;
+}
+
+void inject(const std::string &s)
+{
+  for (char c : s)
+  {
+    rxq.push_back((uint8_t)c);
+  }
+}
+
+void injectBin(const uint8_t *data, uint8_t size)
+{
+  uint8_t check = data[0];
+  for (uint8_t i = 1; i < size; i++)
+  {
+    check ^= data[i];
+  }
+  inject("WSB+");
+  rxq.push_back(0xA0);
+  rxq.push_back(size);
+  rxq.push_back(check);
+  for (uint8_t i = 0; i < size; i++)
+  {
+    rxq.push_back(data[i]);
+  }
+  rxq.push_back(0xA1);
+}
+
+#ifdef ARDUINO_ARCH_RP2040
+FakeRP2040 rp2040;
+#endif
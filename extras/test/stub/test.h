@@ -0,0 +1,39 @@
+/**
+ * Shared helpers for the host tests in extras/test
+ */
+#ifndef __AI_CAMERA_TEST_H__
+#define __AI_CAMERA_TEST_H__
+
+#include <deque>
+#include <stdio.h>
+#include <string>
+
+extern std::deque<uint8_t> rxq;
+extern std::string txlog;
+extern unsigned long fakeNow; // millis(), unless built with -DSTUB_REAL_TIME
+extern bool txBlocked;        // Serial takes nothing and sets its write error
+extern int failures;
+
+/** Queue text on the camera link, as if the ESP32 had sent it */
+void inject(const std::string &s);
+/** Queue one WSB+ binary frame on the camera link */
+void injectBin(const uint8_t *data, uint8_t size);
+
+#define CHECK(cond)                                            \
+  do                                                           \
+  {                                                            \
+    if (!(cond))                                               \
+    {                                                          \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                              \
+    }                                                          \
+  } while (0)
+
+#define TEST_END()                                  \
+  do                                                \
+  {                                                 \
+    printf("%s: %s\n", __FILE__, failures ? "FAIL" : "ok"); \
+    return failures ? 1 : 0;                        \
+  } while (0)
+
+#endif // __AI_CAMERA_TEST_H__
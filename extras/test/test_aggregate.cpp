@@ -0,0 +1,48 @@
+/**
+ * Aggregated regions: a full window of extreme samples must not overflow
+ * the mean, and samples past the window only move min, max and last
+ */
+#include "SunFounder_AI_Camera.h"
+#include "test.h"
+
+static bool sent(const char *field)
+{
+  return txlog.find(field) != std::string::npos;
+}
+
+int main()
+{
+  AiCamera cam("name", "type");
+  cam.setAggregate(REGION_A, AGG_MEAN);
+  cam.setAggregate(REGION_B, AGG_MEAN);
+  cam.setAggregate(REGION_C, AGG_COUNT);
+  cam.setAggregate(REGION_D, AGG_MAX, 1000);
+
+  for (long i = 0; i < 0xFFFF; i++)
+  {
+    cam.addSample(REGION_A, INT32_MAX);
+    cam.addSample(REGION_B, INT32_MIN);
+    cam.addSample(REGION_C, 1);
+  }
+  // past the window, not part of the mean
+  cam.addSample(REGION_A, 0);
+  cam.addSample(REGION_C, 1);
+  cam.addSample(REGION_D, 7400);
+  cam.addSample(REGION_D, -1250);
+
+  txlog.clear();
+  cam.sendData();
+  CHECK(sent("\"A\":2147483647"));
+  CHECK(sent("\"B\":-2147483648"));
+  CHECK(sent("\"C\":65535"));
+  CHECK(sent("\"D\":7.4"));
+
+  // a new window starts after each send
+  cam.addSample(REGION_A, 10);
+  cam.addSample(REGION_A, 20);
+  txlog.clear();
+  cam.sendData();
+  CHECK(sent("\"A\":15"));
+
+  TEST_END();
+}
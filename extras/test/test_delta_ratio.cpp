@@ -0,0 +1,89 @@
+/**
+ * Delta frames of a simulated 3-axis accelerometer at 100 Hz: 16384
+ * counts per g, a slow tilt and +-8 counts of noise. Checks that every
+ * frame decodes to what was added, and the size ratios quoted in the
+ * README for 64 byte frames
+ */
+#include "SunFounder_AI_Camera.h"
+#include "SunFounder_AI_Camera_Delta.h"
+#include "test.h"
+
+#define SAMPLES 6000
+#define CHANNELS 3
+
+static void accelerometer(int i, int32_t *sample)
+{
+  double tilt = 0.3 * sin(i * 0.002);
+  sample[0] = (int32_t)(16384 * sin(tilt)) + rand() % 17 - 8;
+  sample[1] = (int32_t)(800 * sin(i * 0.01)) + rand() % 17 - 8;
+  sample[2] = (int32_t)(16384 * cos(tilt)) + rand() % 17 - 8;
+}
+
+/**
+ * Encode SAMPLES samples into frames of `frameSize` bytes
+ *
+ * @return bytes of all frames, headers included
+ */
+static size_t encode(size_t frameSize, bool *decoded)
+{
+  static int32_t sent[SAMPLES][CHANNELS];
+  uint8_t frame[256];
+  AiCameraDeltaEncoder encoder;
+  AiCameraDeltaDecoder decoder;
+  size_t bytes = 0;
+  int first = 0;
+
+  srand(1);
+  *decoded = true;
+  encoder.begin(frame, frameSize, BIN_TYPE_USER, CHANNELS);
+  for (int i = 0; i <= SAMPLES; i++)
+  {
+    if (i < SAMPLES)
+    {
+      accelerometer(i, sent[i]);
+      if (encoder.add(sent[i]))
+      {
+        continue;
+      }
+    }
+    // frame full, or the last one: check it decodes on its own
+    int32_t sample[DELTA_MAX_CHANNELS];
+    int n = first;
+    *decoded &= decoder.begin(frame + 1, encoder.length() - 1) && decoder.getChannels() == CHANNELS;
+    while (decoder.next(sample))
+    {
+      *decoded &= n < i && memcmp(sample, sent[n], sizeof(sent[n])) == 0;
+      n++;
+    }
+    *decoded &= n == i && encoder.count() == i - first;
+    bytes += encoder.length();
+    first = i;
+    if (i < SAMPLES)
+    {
+      encoder.begin(frame, frameSize, BIN_TYPE_USER, CHANNELS);
+      encoder.add(sent[i]);
+    }
+  }
+  return bytes;
+}
+
+int main()
+{
+  bool decoded;
+  size_t frameSizes[] = {64, 192};
+  for (size_t frameSize : frameSizes)
+  {
+    size_t bytes = encode(frameSize, &decoded);
+    double int32Ratio = SAMPLES * CHANNELS * 4.0 / bytes;
+    double int16Ratio = SAMPLES * CHANNELS * 2.0 / bytes;
+    printf("%zu byte frames: %.2f bytes per sample, %.1fx smaller than int32, %.1fx smaller than int16\n",
+           frameSize, (double)bytes / SAMPLES, int32Ratio, int16Ratio);
+    CHECK(decoded);
+    if (frameSize == 64)
+    {
+      CHECK(int32Ratio >= 3.55);
+      CHECK(int16Ratio >= 1.75);
+    }
+  }
+  TEST_END();
+}
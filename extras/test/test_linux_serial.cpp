@@ -0,0 +1,143 @@
+// build: -D__linux__ -DSTUB_REAL_TIME
+// link: -lutil
+/**
+ * CameraSerial over a pty pair, with a thread answering as ESP32-CAM
+ */
+#include "SunFounder_AI_Camera.h"
+#include "test.h"
+
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+static AiCamera cam("name", "type");
+static std::atomic<int> received(0);
+static std::atomic<int> telemetry(0);
+static std::atomic<unsigned long> telemetryTime(0);
+
+static int openPty(char *name)
+{
+  int master, slave;
+  struct termios tty;
+  openpty(&master, &slave, name, NULL, NULL);
+  tcgetattr(master, &tty);
+  cfmakeraw(&tty);
+  tcsetattr(master, TCSANOW, &tty);
+  return master;
+}
+
+static void reply(int fd, const char *text)
+{
+  ssize_t ignored = ::write(fd, text, strlen(text));
+  (void)ignored;
+}
+
+/**
+ * Answer commands, send a control frame after START, and note when
+ * telemetry arrives
+ */
+static void camera(int fd)
+{
+  std::string line;
+  char c;
+  while (::read(fd, &c, 1) == 1)
+  {
+    if (c == '\r')
+    {
+      continue;
+    }
+    if (c != '\n')
+    {
+      line += c;
+      continue;
+    }
+    if (line.rfind("SET+RESET", 0) == 0)
+    {
+      reply(fd, "[OK] 1.4.0\n");
+    }
+    else if (line.rfind("SET+START", 0) == 0)
+    {
+      reply(fd, "[OK] 192.168.4.1\n");
+      reply(fd, "WS+1;2;3\n");
+    }
+    else if (line.rfind("SET+", 0) == 0)
+    {
+      reply(fd, "[OK]\n");
+    }
+    else if (line.rfind("WS+", 0) == 0)
+    {
+      telemetryTime = millis();
+      telemetry++;
+    }
+    line.clear();
+  }
+}
+
+static void onReceive() { received++; }
+
+/**
+ * Rejects unsupported baud rates, and gives up writing to a tty nobody
+ * reads after the write timeout, with the write error set
+ */
+static void testWriteTimeout()
+{
+  static uint8_t big[200000];
+  char name[64];
+  int master = openPty(name);
+  CHECK(!CameraSerial.begin(name, 250000));
+  CHECK(CameraSerial.begin(name, 115200));
+
+  unsigned long st = millis();
+  size_t written = CameraSerial.write(big, sizeof(big));
+  unsigned long spent = millis() - st;
+  CHECK(written < sizeof(big));
+  CHECK(CameraSerial.getWriteError());
+  CHECK(spent >= 900 && spent < 3000);
+  CameraSerial.clearWriteError();
+  CameraSerial.end();
+  close(master);
+}
+
+/**
+ * The pump task sleeps until data or the app wakes it: telemetry the app
+ * queues is written right away, without the pump polling
+ */
+static void testPumpTask()
+{
+  char name[64];
+  int master = openPty(name);
+  CHECK(CameraSerial.begin(name, 115200));
+  std::thread(camera, master).detach();
+
+  cam.begin("ssid", "password", "8765");
+  cam.setOnReceived(onReceive);
+  for (uint8_t i = 0; i < 20 && received == 0; i++)
+  {
+    cam.loop();
+    cam.idle(100);
+  }
+  CHECK(received == 1);
+
+  CHECK(cam.startTask());
+  delay(200); // the pump task has nothing to do and sleeps
+  int before = telemetry;
+  unsigned long st = millis();
+  cam.sendData();
+  while (telemetry == before && millis() - st < 1000)
+  {
+    delay(1);
+  }
+  CHECK(telemetry == before + 1);
+  CHECK(telemetryTime - st < 50);
+  CHECK(cam.getDroppedTx() == 0);
+}
+
+int main()
+{
+  testWriteTimeout();
+  testPumpTask();
+  // the pump task runs until the process exits
+  printf("%s: %s\n", __FILE__, failures ? "FAIL" : "ok");
+  fflush(stdout);
+  _exit(failures ? 1 : 0);
+}
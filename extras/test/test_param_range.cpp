@@ -0,0 +1,69 @@
+/**
+ * Parameter ranges: int32 ranges are kept exact, also above 2^24 where a
+ * float would round them, and sent to the app like the values
+ */
+#include "SunFounder_AI_Camera.h"
+#include "test.h"
+
+static AiCamera cam("name", "type");
+
+static void setRecord(uint8_t id, uint8_t type, int32_t value)
+{
+  uint8_t data[] = {BIN_TYPE_PARAM, 0xFF, 0xFF, id, type,
+                    (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+  injectBin(data, sizeof(data));
+  cam.loop();
+}
+
+/**
+ * Range of a parameter in the info reply, found by its name
+ */
+static bool infoRange(const char *name, int32_t *min, int32_t *max)
+{
+  size_t at = txlog.find(name);
+  if (at == std::string::npos || at < 8)
+  {
+    return false;
+  }
+  memcpy(min, txlog.data() + at - 8, 4);
+  memcpy(max, txlog.data() + at - 4, 4);
+  return true;
+}
+
+int main()
+{
+  int32_t big = 20000000;
+  float gain = 1.5;
+  CHECK(cam.addParam(0, "Big", &big, 16777217, 2000000001));
+  CHECK(cam.addParam(1, "Gain", &gain, -0.5, 2.5));
+
+  setRecord(0, PARAM_INT32, 0);
+  CHECK(big == 16777217);
+  setRecord(0, PARAM_INT32, INT32_MAX);
+  CHECK(big == 2000000001);
+  setRecord(0, PARAM_INT32, 16777219);
+  CHECK(big == 16777219);
+
+  float value = 9.0;
+  int32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  setRecord(1, PARAM_FLOAT, bits);
+  CHECK(gain == 2.5f);
+
+  inject("[CONNECTED]\n");
+  cam.loop();
+  txlog.clear();
+  uint8_t info[] = {BIN_TYPE_PARAM_INFO};
+  injectBin(info, sizeof(info));
+  cam.loop();
+  int32_t min, max;
+  CHECK(infoRange("Big", &min, &max));
+  CHECK(min == 16777217 && max == 2000000001);
+  float minFloat, maxFloat;
+  CHECK(infoRange("Gain", &min, &max));
+  memcpy(&minFloat, &min, sizeof(minFloat));
+  memcpy(&maxFloat, &max, sizeof(maxFloat));
+  CHECK(minFloat == -0.5f && maxFloat == 2.5f);
+
+  TEST_END();
+}
@@ -0,0 +1,82 @@
+/**
+ * Frames that arrive over several loop() calls, as the UART delivers them
+ * at 115200 baud, are put together; a frame that stalls is dropped
+ */
+#include "SunFounder_AI_Camera.h"
+#include "test.h"
+
+static AiCamera cam("name", "type");
+static std::string line; // bytes still "on the wire"
+static uint8_t payload[WS_BIN_PAYLOAD_SIZE];
+static size_t handled = 0;
+static bool intact = false;
+static int16_t slider = 0;
+
+static void handler(const uint8_t *data, size_t len, void *ctx)
+{
+  (void)ctx;
+  handled = len + 1;
+  intact = memcmp(data, payload + 1, len) == 0;
+}
+
+static void onReceive() { slider = cam.getSlider(REGION_D); }
+
+/**
+ * Deliver the wire bytes a few at a time, one loop() per 1 ms, the way
+ * 115200 baud fills the RX FIFO of a fast MCU
+ */
+static void deliver(size_t perLoop)
+{
+  while (!line.empty())
+  {
+    size_t n = min(perLoop, line.size());
+    inject(line.substr(0, n));
+    line.erase(0, n);
+    cam.loop();
+    delay(1);
+  }
+}
+
+static void wireBinary(const uint8_t *data, uint8_t size)
+{
+  injectBin(data, size);
+  line.assign(rxq.begin(), rxq.end());
+  rxq.clear();
+}
+
+int main()
+{
+  CHECK(cam.setBinaryHandler(BIN_TYPE_USER, handler));
+  cam.setOnReceived(onReceive);
+  for (uint8_t i = 0; i < sizeof(payload); i++)
+  {
+    payload[i] = i * 7 + 1;
+  }
+  payload[0] = BIN_TYPE_USER;
+
+  // a full-size payload, 11 bytes per ms
+  wireBinary(payload, sizeof(payload));
+  deliver(11);
+  CHECK(handled == sizeof(payload));
+  CHECK(intact);
+  CHECK(cam.getDroppedBinary() == 0);
+
+  // a text frame split over many calls
+  line = "WS+;;;42;;;;;;;;;;;;;;;;;;;;;;;;\n";
+  deliver(3);
+  CHECK(slider == 42);
+
+  // half a frame, then nothing for longer than CHAR_TIMEOUT
+  handled = 0;
+  wireBinary(payload, sizeof(payload));
+  line.resize(line.size() / 2);
+  deliver(11);
+  delay(CHAR_TIMEOUT + 1);
+  wireBinary(payload, sizeof(payload));
+  deliver(11);
+  CHECK(cam.getDroppedBinary() == 1);
+  CHECK(handled == sizeof(payload));
+  CHECK(intact);
+
+  TEST_END();
+}
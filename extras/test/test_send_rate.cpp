@@ -0,0 +1,63 @@
+/**
+ * Adaptive telemetry rate: a pong from before a reconnect or an ESP32-CAM
+ * reboot must not count as a stale link, and the interval stays above 0
+ */
+#include "SunFounder_AI_Camera.h"
+#include "test.h"
+
+static AiCamera cam("name", "type");
+
+static void pong(uint32_t pingTime)
+{
+  uint8_t data[5] = {BIN_TYPE_PONG, (uint8_t)pingTime, (uint8_t)(pingTime >> 8),
+                     (uint8_t)(pingTime >> 16), (uint8_t)(pingTime >> 24)};
+  injectBin(data, sizeof(data));
+  cam.loop();
+}
+
+/**
+ * A few control frames, each followed by telemetry and a rate update
+ */
+static void receiveFrames()
+{
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    delay(100);
+    inject("WS+;;;1\n");
+    cam.loop();
+  }
+}
+
+int main()
+{
+  cam.setSendRate(50, 1000);
+  inject("[CONNECTED]\n");
+  cam.loop();
+  fakeNow = 10000;
+  pong(fakeNow - 150);
+  CHECK(cam.getLinkRtt() == 150);
+  receiveFrames();
+  CHECK(cam.getSendInterval() == 50);
+
+  // the app reconnects long after the last pong
+  inject("[DISCONNECTED]\n");
+  cam.loop();
+  delay(60000);
+  inject("[CONNECTED]\n");
+  cam.loop();
+  CHECK(cam.getLinkRtt() == 0);
+  receiveFrames();
+  CHECK(cam.getSendInterval() == 50);
+
+  // ESP32-CAM reboots
+  pong(fakeNow - 20);
+  CHECK(cam.getLinkRtt() == 20);
+  inject("[Init]\n");
+  cam.loop();
+  CHECK(cam.getLinkRtt() == 0);
+
+  cam.setSendRate(0, 100);
+  CHECK(cam.getSendInterval() == 1);
+
+  TEST_END();
+}
@@ -0,0 +1,125 @@
+// build: -DARDUINO_ARCH_RP2040 -DAI_CAM_TASK
+/**
+ * Task mode hand-over between two threads, as between the pump task and
+ * loop(): the control frame double buffer must never hand out a torn frame,
+ * and the TX queue must deliver every committed frame whole and in order
+ */
+#include "SunFounder_AI_Camera.h"
+#include "test.h"
+
+#define FRAMES 100000UL
+
+static AiCameraSnapshot snapshot;
+static AiCameraFrameQueue queue;
+static std::atomic<bool> writerDone(false);
+
+/**
+ * Frame n: its number, then the rest of the buffer filled with one letter
+ * that depends on n
+ */
+static void fillFrame(char *frame, uint32_t n)
+{
+  snprintf(frame, WS_BUFFER_SIZE, "%010u", n);
+  memset(frame + 10, 'A' + n % 26, WS_BUFFER_SIZE - 11);
+  frame[WS_BUFFER_SIZE - 1] = '\0';
+}
+
+static void testSnapshot()
+{
+  std::thread writer([] {
+    char frame[WS_BUFFER_SIZE];
+    for (uint32_t n = 1; n <= FRAMES; n++)
+    {
+      fillFrame(frame, n);
+      snapshot.write(frame);
+    }
+    writerDone = true;
+  });
+
+  char frame[WS_BUFFER_SIZE];
+  uint32_t seq = 0;
+  uint32_t last = 0;
+  uint32_t reads = 0;
+  bool torn = false;
+  bool backwards = false;
+  while (!writerDone || snapshot.changed(seq))
+  {
+    if (!snapshot.read(frame, &seq))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    reads++;
+    uint32_t n = strtoul(frame, NULL, 10);
+    char expect[WS_BUFFER_SIZE];
+    fillFrame(expect, n);
+    torn |= memcmp(frame, expect, WS_BUFFER_SIZE) != 0;
+    backwards |= n <= last;
+    last = n;
+  }
+  writer.join();
+  CHECK(!torn);
+  CHECK(!backwards);
+  CHECK(reads > 0);
+  CHECK(last == FRAMES);
+}
+
+static void testFrameQueue()
+{
+  std::thread producer([] {
+    for (uint32_t n = 0; n < FRAMES; n++)
+    {
+      uint8_t length = 1 + n % 50;
+      while (true)
+      {
+        queue.begin();
+        for (uint8_t i = 0; i < length; i++)
+        {
+          queue.write((uint8_t)(n + i));
+        }
+        if (queue.commit())
+        {
+          break;
+        }
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t received = 0;
+  bool corrupt = false;
+  while (received < FRAMES && !corrupt)
+  {
+    uint16_t length;
+    uint32_t since;
+    if (!queue.next(&length, &since))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    uint8_t frame[64];
+    size_t got = 0;
+    corrupt = length != 1 + received % 50;
+    while (!corrupt && got < length)
+    {
+      got += queue.read(frame + got, length - got);
+      std::this_thread::yield();
+    }
+    for (uint8_t i = 0; i < length && !corrupt; i++)
+    {
+      corrupt = frame[i] != (uint8_t)(received + i);
+    }
+    received++;
+  }
+  producer.join();
+  CHECK(!corrupt);
+  CHECK(received == FRAMES);
+  CHECK(queue.isEmpty());
+}
+
+int main()
+{
+  testSnapshot();
+  testFrameQueue();
+  TEST_END();
+}
@@ -0,0 +1,43 @@
+/**
+ * Frames DataSerial gives up on are counted as dropped, not as sent
+ */
+#include "SunFounder_AI_Camera.h"
+#include "test.h"
+
+static uint8_t data[100];
+
+static size_t producer(uint32_t offset, uint8_t *buffer, size_t size)
+{
+  memcpy(buffer, data + offset, size);
+  return size;
+}
+
+int main()
+{
+  AiCamera cam("name", "type");
+  const AiCameraLaneStats *urgent = cam.getLaneStats(TX_LANE_URGENT);
+  const AiCameraLaneStats *bulk = cam.getLaneStats(TX_LANE_BULK);
+
+  cam.sendData();
+  CHECK(urgent->frames == 1);
+  CHECK(cam.getDroppedTx() == 0);
+
+  txBlocked = true;
+  cam.sendData();
+  CHECK(urgent->frames == 1);
+  CHECK(cam.getDroppedTx() == 1);
+
+  // a cut chunk is not counted as sent, and goes again after BULK_TIMEOUT
+  CHECK(cam.sendBulk(sizeof(data), producer));
+  cam.loop();
+  CHECK(bulk->frames == 0);
+  CHECK(cam.getDroppedTx() == 2);
+
+  // the error does not stick to the next frame
+  txBlocked = false;
+  cam.sendData();
+  CHECK(urgent->frames == 2);
+  CHECK(cam.getDroppedTx() == 2);
+
+  TEST_END();
+}
@@ -1,4 +1,41 @@
+#if defined(__linux__)
+#include <thread>
+#include <pthread.h>
+#endif
 #include "SunFounder_AI_Camera.h"
+#ifdef AI_CAM_EEPROM
+#include <EEPROM.h>
+#endif
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#if defined(__AVR__)
+#include <avr/sleep.h>
+extern char __heap_start;
+extern char *__brkval;
+#endif
+
+/**
+ * Hand a state byte between the app and the pump task: the fields written
+ * before STATE_PUBLISH() are seen by the side that reads it with STATE_ACQUIRE()
+ */
+#ifdef AI_CAM_TASK
+#define STATE_PUBLISH(state, value) __atomic_store_n(&(state), (value), __ATOMIC_RELEASE)
+#define STATE_ACQUIRE(state) __atomic_load_n(&(state), __ATOMIC_ACQUIRE)
+#define STATE_SET_BITS(state, bits) __atomic_fetch_or(&(state), (bits), __ATOMIC_RELEASE)
+#define STATE_TAKE_BITS(state) __atomic_exchange_n(&(state), 0, __ATOMIC_ACQUIRE)
+#else
+#define STATE_PUBLISH(state, value) ((state) = (value))
+#define STATE_ACQUIRE(state) (state)
+#define STATE_SET_BITS(state, bits) ((state) |= (bits))
+#define STATE_TAKE_BITS(state) takeBits(&(state))
+static uint8_t takeBits(uint8_t *state)
+{
+  uint8_t bits = *state;
+  *state = 0;
+  return bits;
+}
+#endif
 
 /**
  *  functions for manipulating string
@@ -10,24 +47,32 @@
   str[len + 1] = '\0'
 #define StrClear(str) str[0] = 0
 
+// keep AI_CAM_GLOBAL_RAM in step with the globals below
 int32_t cmdTimeout = SERIAL_TIMEOUT;
 int32_t wsSendTime = millis();
 int32_t wsSendInterval = 60; // 100
 
-int32_t volSendTime = millis();
-int32_t volSendInterval = 5000;
-
 /**
  * Declare global variables
  */
-char name[25];
-char type[25];
+char name[NAME_SIZE];
+char type[NAME_SIZE];
 
 /**
  * Declare the receive callback function
  */
 void (*__onReceive__)();
 void (*__onReceiveBinary__)();
+void (*__onIdle__)(uint32_t timeout);
+void (*__onVision__)();
+void (*__onFailsafe__)();
+void (*__onParam__)(uint8_t id);
+#if BULK_TRANSFER
+size_t (*__bulkProducer__)(uint32_t offset, uint8_t *buffer, size_t size);
+#endif
+#if SNAPSHOT_TRANSFER
+bool (*__snapshotSink__)(uint32_t offset, const uint8_t *data, size_t size);
+#endif
 
 /**
  * @brief instantiate AiCamera Class, set name and type
@@ -36,8 +81,8 @@ void (*__onReceiveBinary__)();
  */
 AiCamera::AiCamera(const char *_name, const char *_type)
 {
-  strcpy(name, _name);
-  strcpy(type, _type);
+  strncpy(name, _name, NAME_SIZE - 1);
+  strncpy(type, _type, NAME_SIZE - 1);
 }
 
 /** !!!!!!!     Plan to deprecate   !!!!!!!
@@ -56,11 +101,15 @@ void AiCamera::begin(const char *ssid, const char *password, const char *wifiMod
 #ifdef AI_CAM_DEBUG_CUSTOM
   DateSerial.begin(115200);
 #endif
-  char ip[25];
-  char version[25];
+  char ip[REPLY_SIZE];
+  char version[REPLY_SIZE];
+  this->ssid = ssid;
+  this->password = password;
+  this->wifiMode = wifiMode;
+  this->wsPort = wsPort;
 
   setCommandTimeout(3000);
-  this->get("RESET", version);
+  this->get("RESET", version, sizeof(version));
   DebugSerial.print(F("ESP32 firmware version "));
   DebugSerial.println(version);
 
@@ -73,7 +122,7 @@ void AiCamera::begin(const char *ssid, const char *password, const char *wifiMod
   this->set("PORT", wsPort);
 
   setCommandTimeout(5000);
-  this->get("START", ip);
+  this->get("START", ip, sizeof(ip));
   delay(20);
   DebugSerial.print(F("WebServer started on ws://"));
   DebugSerial.print(ip);
@@ -84,6 +133,7 @@ void AiCamera::begin(const char *ssid, const char *password, const char *wifiMod
   DebugSerial.println(F(":9000/mjpg"));
 
   setCommandTimeout(SERIAL_TIMEOUT);
+  provisioned = true;
 }
 
 /**
@@ -100,12 +150,16 @@ void AiCamera::begin(const char *ssid, const char *password, const char *wsPort,
 #ifdef ARDUINO_MINIMA
   DataSerial.begin(115200);
 #endif
-  char ip[25];
-  char version[25];
+  char ip[REPLY_SIZE];
+  char version[REPLY_SIZE];
   this->autoSend = autoSend;
+  this->ssid = ssid;
+  this->password = password;
+  this->wifiMode = NULL;
+  this->wsPort = wsPort;
 
   setCommandTimeout(3000);
-  this->get("RESET", version);
+  this->get("RESET", version, sizeof(version));
   DebugSerial.print(F("ESP32 firmware version "));
   DebugSerial.println(version);
   if (!checkFirmwareVersion(String(version)))
@@ -129,7 +183,7 @@ void AiCamera::begin(const char *ssid, const char *password, const char *wsPort,
   this->set("PORT", wsPort);
 
   setCommandTimeout(10000);
-  this->get("START", ip);
+  this->get("START", ip, sizeof(ip));
   delay(20);
   DebugSerial.print(F("WebServer started on ws://"));
   DebugSerial.print(ip);
@@ -140,6 +194,7 @@ void AiCamera::begin(const char *ssid, const char *password, const char *wsPort,
   DebugSerial.println(F(":9000/mjpg"));
 
   setCommandTimeout(SERIAL_TIMEOUT);
+  provisioned = true;
 }
 
 /**
@@ -157,12 +212,298 @@ void AiCamera::setOnReceived(void (*func)()) { __onReceive__ = func; }
 void AiCamera::setOnReceivedBinary(void (*func)()) { __onReceiveBinary__ = func; }
 
 /**
- * @brief Receive and process serial port data in a loop
+ * @brief Set callback function method to sleep in idle(),
+ *        replaces the default CPU sleep
+ *
+ * @param func  callback function pointer, receives the longest time to sleep in ms.
+ *              It should return early when DataSerial receives data. In task mode
+ *              it is only called from the sketch's idle(), never from the pump task
+ */
+void AiCamera::setOnIdle(void (*func)(uint32_t timeout)) { __onIdle__ = func; }
+
+/**
+ * @brief Route a binary message type to a handler. The handler gets the
+ *        payload after the type byte, in place in the receive buffer.
+ *        Messages of types without a handler go to the setOnReceivedBinary()
+ *        callback if set, or are counted and dropped
+ *
+ * @param type first byte of the payload, BIN_TYPE_USER and above
+ * @param handler handler function, NULL to remove the route
+ * @param ctx passed to the handler as is
+ * @return false if the type is below BIN_TYPE_USER, reserved for the
+ *         library, or if all BIN_HANDLER_COUNT routes are used, always on
+ *         AVR unless BIN_HANDLER_COUNT is set
+ *
+ * @code {.cpp}
+ * void onConfig(const uint8_t *data, size_t len, void *ctx) {
+ *   Config *config = (Config *)ctx;
+ *   ...
+ * }
+ * aiCam.setBinaryHandler(BIN_TYPE_USER + 1, onConfig, &config);
+ * @endcode
+ */
+bool AiCamera::setBinaryHandler(uint8_t type, AiCameraBinaryHandler handler, void *ctx)
+{
+  if (type < BIN_TYPE_USER)
+  {
+    return false;
+  }
+#if BIN_HANDLER_COUNT > 0
+  for (uint8_t i = 0; i < routeCount; i++)
+  {
+    if (routes[i].type != type)
+    {
+      continue;
+    }
+    if (handler == NULL)
+    {
+      routes[i] = routes[--routeCount];
+      return true;
+    }
+    routes[i].handler = handler;
+    routes[i].ctx = ctx;
+    return true;
+  }
+  if (handler == NULL)
+  {
+    return true;
+  }
+  if (routeCount >= BIN_HANDLER_COUNT)
+  {
+    return false;
+  }
+  routes[routeCount].type = type;
+  routes[routeCount].handler = handler;
+  routes[routeCount].ctx = ctx;
+  routeCount++;
+  return true;
+#else
+  (void)handler;
+  (void)ctx;
+  return false;
+#endif
+}
+
+/**
+ * @brief Number of binary messages dropped because no handler took them,
+ *        or because they were longer than WS_BIN_PAYLOAD_SIZE
+ */
+uint16_t AiCamera::getDroppedBinary()
+{
+  return droppedBinary;
+}
+
+/**
+ * @brief Number of frames that were not sent whole: cut because DataSerial
+ *        gave up writing (the Linux tty stayed full for 1 s), or in task
+ *        mode dropped because the TX queue was full
+ */
+uint16_t AiCamera::getDroppedTx()
+{
+#ifdef AI_CAM_TASK
+  return droppedTx + txQueue.dropped;
+#else
+  return droppedTx;
+#endif
+}
+
+/**
+ * @brief Set callback function method for receive vision results,
+ *        read them with getVision() and getDetections()
+ *
+ * @param func  callback function pointer
+ */
+void AiCamera::setOnVision(void (*func)()) { __onVision__ = func; }
+
+/**
+ * @brief Time since the last control frame, or since the last frame
+ *        with a value for `region`, in ms. Since boot if none arrived.
+ *        Without INPUT_REGION_AGE every region has the age of the last frame
+ *
+ * @param region the key of component, or INPUT_ANY for any WS+ frame
+ */
+uint32_t AiCamera::inputAge(uint8_t region)
+{
+#if INPUT_REGION_AGE
+  if (region <= REGION_Z)
+  {
+    return millis() - regionInputTime[region];
+  }
+#else
+  (void)region;
+#endif
+  return millis() - inputTime;
+}
+
+/**
+ * @brief Call `func` once when no control input arrived for `timeout` ms,
+ *        e.g. to stop the motors. It is called from loop(), also when no
+ *        input arrived at all after boot, and armed again by the next input
+ *
+ * @param timeout input age in ms, 0 to disable
+ * @param func  callback function pointer
+ * @param region the key of component to watch, or INPUT_ANY for any WS+ frame
+ * @return false if region is invalid, or is not INPUT_ANY without INPUT_REGION_AGE
+ *
+ * @code {.cpp}
+ * aiCam.setFailsafe(300, stopMotors);
+ * @endcode
+ */
+bool AiCamera::setFailsafe(uint16_t timeout, void (*func)(), uint8_t region)
+{
+  if (region > REGION_Z && region != INPUT_ANY)
+  {
+    return false;
+  }
+#if INPUT_REGION_AGE
+  failsafeInput = region == INPUT_ANY ? &inputTime : &regionInputTime[region];
+#else
+  if (region != INPUT_ANY)
+  {
+    return false;
+  }
+#endif
+  __onFailsafe__ = func;
+  failsafeTimeout = timeout;
+  failsafeActive = false;
+  return true;
+}
+
+/**
+ * @brief Whether the failsafe was applied and no input arrived since
+ */
+bool AiCamera::isFailsafe()
+{
+  return failsafeActive;
+}
+
+/**
+ * @brief Stamp a control frame and the regions it has a value for
+ *
+ * @param frame control frame, without WS_HEADER
+ */
+void AiCamera::inputReceived(const char *frame)
+{
+  uint32_t now = millis();
+  inputTime = now;
+#if INPUT_REGION_AGE
+  uint8_t region = 0;
+  for (const char *p = frame; region <= REGION_Z; p++)
+  {
+    if (*p == ';' || *p == '\0')
+    {
+      region++;
+    }
+    else if (p == frame || p[-1] == ';')
+    {
+      regionInputTime[region] = now;
+    }
+    if (*p == '\0')
+    {
+      break;
+    }
+  }
+#else
+  (void)frame;
+#endif
+  // re-armed only by the input it watches
+  if (*failsafeInput == now)
+  {
+    failsafeActive = false;
+  }
+}
+
+/**
+ * @brief Apply the failsafe once the watched input is too old
+ */
+void AiCamera::failsafeLoop()
+{
+  if (failsafeTimeout == 0 || failsafeActive || millis() - *failsafeInput < failsafeTimeout)
+  {
+    return;
+  }
+  failsafeActive = true;
+  if (__onFailsafe__ != NULL)
+  {
+    __onFailsafe__();
+  }
+}
+
+/**
+ * @brief Receive and process serial port data in a loop.
+ *        In task mode it only hands the latest control frame
+ *        to the onReceive callback and sends telemetry back
  */
 void AiCamera::loop()
 {
-  this->readInto(recvBuffer);
-  if (strlen(recvBuffer) != 0 || recvBufferType != WS_BUFFER_TYPE_NONE)
+#ifdef AI_CAM_TASK
+  if (taskMode)
+  {
+    this->videoLoop();
+#if PARAM_SLOT_COUNT > 0
+    // parameter messages handed over by the pump task, applied here where
+    // the sketch uses the values
+    uint16_t length;
+    uint32_t since;
+    while (paramQueue.next(&length, &since))
+    {
+      uint8_t data[WS_BUFFER_SIZE];
+      uint8_t size = paramQueue.read(data, min((size_t)length, sizeof(data)));
+      this->paramReceive(data, size);
+    }
+    this->paramLoop();
+#endif
+    if (!controlSnapshot.read(appBuffer, &appSeq))
+    {
+      this->failsafeLoop();
+      return;
+    }
+    this->inputReceived(appBuffer);
+    if (__onReceive__ != NULL)
+    {
+      __onReceive__();
+    }
+    this->autoSendData();
+    return;
+  }
+#endif
+  this->videoLoop();
+  this->pump();
+  this->failsafeLoop();
+}
+
+#ifdef AI_CAM_TASK
+/**
+ * @brief Id of the task, thread or core the caller runs on
+ */
+static uintptr_t currentContext()
+{
+#if defined(ESP32)
+  return (uintptr_t)xTaskGetCurrentTaskHandle();
+#elif defined(ARDUINO_ARCH_RP2040)
+  return rp2040.cpuid();
+#else
+  return (uintptr_t)pthread_self();
+#endif
+}
+#endif
+
+/**
+ * @brief Read and parse serial port data, and write the outgoing frames.
+ *        Called by loop(), or in task mode by the task startTask() created.
+ *        If startTask() can not create a task on this board, call it
+ *        from the other core, e.g. in loop1() on RP2040
+ */
+void AiCamera::pump()
+{
+#ifdef AI_CAM_TASK
+  if (taskMode)
+  {
+    __atomic_store_n(&pumpContext, currentContext(), __ATOMIC_RELAXED);
+  }
+#endif
+  this->provisionLoop();
+  if (this->readInto(recvBuffer))
   {
     // Serial.print("recv: ");Serial.println(recvBuffer);
 
@@ -171,12 +512,27 @@ void AiCamera::loop()
     {
       // Serial.println(F("ESP32-CAM reboot detected"));
       ws_connected = false;
+      this->pongReset();
+      if (provisioned)
+      {
+        // replay the last-applied configuration in the background
+        rebootTime = millis();
+        provisionState = PROVISION_SETTLE;
+        provisionTime = rebootTime;
+        provisionDelay = PROVISION_SETTLE_TIME;
+      }
+    }
+    // ESP32-CAM acknowledged a re-provisioning command
+    else if (provisionState == PROVISION_RUN && IsStartWith(recvBuffer, OK_FLAG))
+    {
+      this->provisionAck();
     }
     // ESP32-CAM websocket connected
     else if (IsStartWith(recvBuffer, WS_CONNECT))
     {
       // Serial.println(F("ESP32-CAM websocket connected"));
       ws_connected = true;
+      this->pongReset();
     }
     // ESP32-CAM websocket disconnected
     else if (IsStartWith(recvBuffer, WS_DISCONNECT))
@@ -201,722 +557,3208 @@ void AiCamera::loop()
       // DataSerial.print("RX:"); DataSerial.println(recvBuffer);
       ws_connected = true;
       this->subString(recvBuffer, strlen(WS_HEADER));
-      if (__onReceive__ != NULL)
+#ifdef AI_CAM_TASK
+      if (taskMode)
       {
-        __onReceive__();
-        // if (millis() - wsSendTime > wsSendInterval) {
-        //   this->sendData();
-        //   wsSendTime = millis();
-        // }
+        controlSnapshot.write(recvBuffer);
+      }
+      else
+#endif
+      {
+        this->inputReceived(recvBuffer);
+        if (__onReceive__ != NULL)
+        {
+          __onReceive__();
+          // if (millis() - wsSendTime > wsSendInterval) {
+          //   this->sendData();
+          //   wsSendTime = millis();
+          // }
+        }
       }
     }
     // recv WSB+ binary data
     else if (recvBufferType == WS_BUFFER_TYPE_BINARY)
     {
-      ws_connected = true;
       // this->subString(recvBuffer, strlen(WS_BIN_HEADER));
-      if (__onReceiveBinary__ != NULL)
+      // only while the library waits for them, other payloads go on to the sketch
+      if (recvBufferLength == 4 && recvBuffer[0] == BIN_TYPE_BULK_ACK && this->getBulkState() == BULK_BUSY)
+      {
+        this->bulkAck();
+      }
+#if RATE_CONTROL
+      else if (recvBufferLength == 5 && recvBuffer[0] == BIN_TYPE_PONG && rateControl)
+      {
+        uint32_t pingSent = (uint32_t)recvBuffer[1] | ((uint32_t)recvBuffer[2] << 8) |
+                            ((uint32_t)recvBuffer[3] << 16) | ((uint32_t)recvBuffer[4] << 24);
+        uint32_t now = millis();
+        // rateUpdate() reads them on the app side in task mode
+        STATE_PUBLISH(linkRtt, (uint16_t)min(now - pingSent, (uint32_t)0xFFFF));
+        STATE_PUBLISH(pongTime, now);
+        STATE_PUBLISH(pongSeen, true);
+      }
+#endif
+      else if (recvBufferLength >= SNAPSHOT_HEADER_LENGTH && recvBuffer[0] == BIN_TYPE_SNAPSHOT &&
+               this->getSnapshotState() == SNAPSHOT_BUSY)
+      {
+        this->snapshotChunk();
+      }
+      // the messages above are between ESP32-CAM and the library only
+      else
       {
-        __onReceiveBinary__();
+        ws_connected = true;
+        AiCameraBinaryRoute *route = NULL;
+#if BIN_HANDLER_COUNT > 0
+        for (uint8_t i = 0; i < routeCount && recvBufferLength > 0; i++)
+        {
+          if (routes[i].type == recvBuffer[0])
+          {
+            route = &routes[i];
+            break;
+          }
+        }
+#endif
+        if (__onVision__ != NULL && this->isVision())
+        {
+          __onVision__();
+        }
+        else if (paramCount > 0 && ((recvBufferLength >= PARAM_HEADER_LENGTH && recvBuffer[0] == BIN_TYPE_PARAM) ||
+                                    (recvBufferLength == 1 && recvBuffer[0] == BIN_TYPE_PARAM_INFO)))
+        {
+          this->paramReceive(recvBuffer, recvBufferLength);
+        }
+        else if (route != NULL)
+        {
+          route->handler(recvBuffer + 1, recvBufferLength - 1, route->ctx);
+        }
+        // payloads without a type byte, for sketches using setOnReceivedBinary()
+        else if (__onReceiveBinary__ != NULL)
+        {
+          __onReceiveBinary__();
+        }
+        else
+        {
+          droppedBinary++;
+        }
       }
     }
 
-    if (this->autoSend)
+    if (!taskMode)
     {
-      if (millis() - wsSendTime > wsSendInterval)
-      {
-        this->sendData();
-        wsSendTime = millis();
-      }
+      this->autoSendData();
     }
 
     recvBufferType = WS_BUFFER_TYPE_NONE;
   }
+
+#ifdef AI_CAM_TASK
+  // frames queued by the app, their latency counts until they are written
+  uint16_t length;
+  uint32_t since;
+  while (txQueue.next(&length, &since))
+  {
+    DataSerial.clearWriteError();
+    while (length > 0)
+    {
+      uint8_t data[32];
+      size_t size = txQueue.read(data, min((size_t)length, sizeof(data)));
+      DataSerial.write(data, size);
+      length -= size;
+    }
+    if (!this->txFailed())
+    {
+      txDone(TX_LANE_URGENT, since);
+    }
+  }
+#endif
+
+  this->snapshotLoop();
+  this->pingLoop();
+  if (!taskMode)
+  {
+    // the app side sends the parameters in task mode, see loop()
+    this->paramLoop();
+  }
+  // bulk lane last, after received data and telemetry are handled
+  this->bulkLoop();
 }
 
 /**
- * @brief Print the information received from esp32-CAm,
- *        according to the set of CAM_DEBUG_LEVEL
+ * @brief Switch to task mode: a dedicated task owns DataSerial and runs
+ *        pump(), the app thread only runs loop() and the callbacks.
+ *        Call it after begin(). Blocking commands like reset(true)
+ *        sent by the app do not wait for [OK] in task mode
  *
- * @param msg Message to be detected
+ * @return true if a task was created (ESP32, Linux), false if pump()
+ *         has to be called from another core by the sketch
  */
-void AiCamera::debug(char *msg)
+bool AiCamera::startTask()
 {
-#if (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_ALL) // all
-  DebugSerial.println(msg);
-#elif (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_ERROR) // error
-  if (IsStartWith(msg, CAM_DEBUG_HEAD_ERROR))
+#ifdef AI_CAM_TASK
+  taskMode = true;
+#if defined(ESP32)
+#if CONFIG_FREERTOS_UNICORE
+  xTaskCreate(pumpTask, "AiCamera", PUMP_TASK_STACK, this, 1, NULL);
+#else
+  // the core not running the sketch
+  xTaskCreatePinnedToCore(pumpTask, "AiCamera", PUMP_TASK_STACK, this, 1, NULL, 1 - xPortGetCoreID());
+#endif
+  return true;
+#elif defined(__linux__)
+  std::thread(pumpTask, this).detach();
+  return true;
+#else
+  return false;
+#endif
+#else
+  return false;
+#endif
+}
+
+#ifdef AI_CAM_TASK
+void AiCamera::pumpTask(void *arg)
+{
+  AiCamera *cam = (AiCamera *)arg;
+  while (true)
   {
-    DebugSerial.println(msg);
+    cam->pump();
+    // woken early by DataSerial or by the app, see wakePump()
+    cam->idle(cam->getNextDeadline());
   }
-#elif (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_INFO)  // info
-  if (IsStartWith(msg, CAM_DEBUG_HEAD_ERROR))
+}
+
+/**
+ * @brief Publish a control frame, never blocks
+ *
+ * @param data null terminated control frame
+ */
+void AiCameraSnapshot::write(const char *data)
+{
+  uint32_t s = __atomic_load_n(&seq, __ATOMIC_RELAXED);
+  // odd while writing the buffer that is not published
+  __atomic_store_n(&seq, s + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  char *dst = buffer[((s >> 1) + 1) & 1];
+  strncpy(dst, data, WS_BUFFER_SIZE - 1);
+  dst[WS_BUFFER_SIZE - 1] = '\0';
+  __atomic_store_n(&seq, s + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copy the latest control frame if there is a new one
+ *
+ * @param data WS_BUFFER_SIZE bytes to copy to
+ * @param lastSeq sequence of the frame read last time, updated
+ * @return false if there is no new frame
+ */
+bool AiCameraSnapshot::read(char *data, uint32_t *lastSeq)
+{
+  for (uint8_t retry = 0; retry < 3; retry++)
   {
-    DebugSerial.println(msg);
+    uint32_t base = __atomic_load_n(&seq, __ATOMIC_ACQUIRE) & ~1UL;
+    if (base == *lastSeq)
+    {
+      return false;
+    }
+    memcpy(data, buffer[(base >> 1) & 1], WS_BUFFER_SIZE);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // the buffer read is only written again after the next publish
+    if (__atomic_load_n(&seq, __ATOMIC_RELAXED) - base <= 2)
+    {
+      *lastSeq = base;
+      return true;
+    }
   }
-  else if (IsStartWith(msg, CAM_DEBUG_HEAD_INFO))
+  return false;
+}
+
+/**
+ * @brief Whether a control frame was published since `lastSeq`, without
+ *        taking it
+ */
+bool AiCameraSnapshot::changed(uint32_t lastSeq)
+{
+  return (__atomic_load_n(&seq, __ATOMIC_RELAXED) & ~1UL) != lastSeq;
+}
+
+/**
+ * @brief Start a frame, it is only visible to the consumer after commit()
+ */
+void AiCameraFrameQueue::begin()
+{
+  pending = head;
+  stamp = micros();
+  overflow = false;
+  // room for the header, filled in by commit()
+  for (uint8_t i = 0; i < TX_QUEUE_FRAME_HEADER; i++)
   {
-    DebugSerial.println(msg);
+    write(0);
   }
-#elif (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_DEBUG) // debug
-  if (IsStartWith(msg, CAM_DEBUG_HEAD_ERROR))
+}
+
+size_t AiCameraFrameQueue::write(uint8_t c)
+{
+  uint16_t next = (pending + 1) % TX_QUEUE_SIZE;
+  if (overflow || next == __atomic_load_n(&tail, __ATOMIC_ACQUIRE))
   {
-    DebugSerial.println(msg);
+    overflow = true;
+    return 0;
   }
-  else if (IsStartWith(msg, CAM_DEBUG_HEAD_INFO))
+  buffer[pending] = c;
+  pending = next;
+  return 1;
+}
+
+/**
+ * @brief Publish the frame written since begin()
+ *
+ * @return false if the queue was full, the whole frame is dropped
+ */
+bool AiCameraFrameQueue::commit()
+{
+  if (overflow)
   {
-    DebugSerial.println(msg);
+    dropped++;
+    return false;
   }
-  else if (IsStartWith(msg, CAM_DEBUG_HEAD_DEBUG))
+  uint16_t length = (pending + TX_QUEUE_SIZE - head) % TX_QUEUE_SIZE - TX_QUEUE_FRAME_HEADER;
+  uint8_t header[TX_QUEUE_FRAME_HEADER] = {
+      (uint8_t)(length & 0xFF), (uint8_t)(length >> 8),
+      (uint8_t)(stamp & 0xFF), (uint8_t)(stamp >> 8),
+      (uint8_t)(stamp >> 16), (uint8_t)(stamp >> 24)};
+  for (uint8_t i = 0; i < TX_QUEUE_FRAME_HEADER; i++)
   {
-    DebugSerial.println(msg);
+    buffer[(head + i) % TX_QUEUE_SIZE] = header[i];
   }
-#endif
+  __atomic_store_n(&head, pending, __ATOMIC_RELEASE);
+  return true;
 }
 
 /**
- * @brief Store the data read from the serial port into the buffer
+ * @brief Bytes waiting in the queue
+ */
+uint16_t AiCameraFrameQueue::used()
+{
+  uint16_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  uint16_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+  return (h + TX_QUEUE_SIZE - t) % TX_QUEUE_SIZE;
+}
+
+bool AiCameraFrameQueue::isEmpty()
+{
+  return __atomic_load_n(&head, __ATOMIC_ACQUIRE) == __atomic_load_n(&tail, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Take the header of the next published frame, consumer side.
+ *        Read its bytes with read() before calling it again
+ *
+ * @param length returned frame length
+ * @param since returned micros() when the app started the frame
+ * @return false if the queue is empty
+ */
+bool AiCameraFrameQueue::next(uint16_t *length, uint32_t *since)
+{
+  uint8_t header[TX_QUEUE_FRAME_HEADER];
+  if (isEmpty())
+  {
+    return false;
+  }
+  read(header, TX_QUEUE_FRAME_HEADER);
+  *length = header[0] | (header[1] << 8);
+  *since = header[2] | ((uint32_t)header[3] << 8) | ((uint32_t)header[4] << 16) | ((uint32_t)header[5] << 24);
+  return true;
+}
+
+/**
+ * @brief Take up to `size` published bytes, consumer side
+ */
+size_t AiCameraFrameQueue::read(uint8_t *data, size_t size)
+{
+  uint16_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  uint16_t t = tail;
+  size_t count = 0;
+  while (t != h && count < size)
+  {
+    data[count++] = buffer[t];
+    t = (t + 1) % TX_QUEUE_SIZE;
+  }
+  __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+  return count;
+}
+#endif
+
+/**
+ * @brief Whether the caller runs where pump() runs and may use DataSerial,
+ *        always outside task mode. In task mode callbacks run in the pump,
+ *        and what they send must not go through the app's TX queue
+ */
+bool AiCamera::inPump()
+{
+#ifdef AI_CAM_TASK
+  return !taskMode || __atomic_load_n(&pumpContext, __ATOMIC_RELAXED) == currentContext();
+#else
+  return true;
+#endif
+}
+
+/**
+ * @brief Buffer the getters parse: the latest control frame handed over
+ *        in task mode, recvBuffer otherwise
+ */
+char *AiCamera::ctrlBuffer()
+{
+#ifdef AI_CAM_TASK
+  if (taskMode)
+  {
+    return appBuffer;
+  }
+#endif
+  return (char *)recvBuffer;
+}
+
+/**
+ * @brief Where a frame is written: the TX queue when the app sends in task
+ *        mode, DataSerial otherwise. End the frame with txEnd(), which
+ *        records its urgent lane latency, in task mode once the pump wrote it
+ */
+Print &AiCamera::txBegin()
+{
+#ifdef AI_CAM_TASK
+  if (!this->inPump())
+  {
+    txQueue.begin();
+    return txQueue;
+  }
+#endif
+  DataSerial.clearWriteError();
+  return DataSerial;
+}
+
+void AiCamera::txEnd(uint32_t since)
+{
+#ifdef AI_CAM_TASK
+  if (!this->inPump())
+  {
+    txQueue.commit();
+    this->wakePump();
+    return;
+  }
+#endif
+  if (!this->txFailed())
+  {
+    txDone(TX_LANE_URGENT, since);
+  }
+}
+
+/**
+ * @brief Whether DataSerial dropped part of the frame written since
+ *        clearWriteError(), e.g. the Linux tty stayed full for its write
+ *        timeout. The frame is counted, see getDroppedTx()
+ */
+bool AiCamera::txFailed()
+{
+  if (!DataSerial.getWriteError())
+  {
+    return false;
+  }
+  DataSerial.clearWriteError();
+  droppedTx++;
+  return true;
+}
+
+/**
+ * @brief End the pump task's idle() early, called on the app side after
+ *        queuing a frame or starting work the pump has no deadline for yet
+ */
+void AiCamera::wakePump()
+{
+#ifdef AI_CAM_TASK
+  if (taskMode && !this->inPump())
+  {
+    __atomic_store_n(&pumpWake, true, __ATOMIC_RELEASE);
+#if defined(__linux__)
+    CameraSerial.wake();
+#endif
+  }
+#endif
+}
+
+/**
+ * @brief Take the wake-up of wakePump(), pump side
+ */
+bool AiCamera::pumpWoken()
+{
+#ifdef AI_CAM_TASK
+  return taskMode && this->inPump() && __atomic_exchange_n(&pumpWake, false, __ATOMIC_ACQUIRE);
+#else
+  return false;
+#endif
+}
+
+/**
+ * Commands of the re-provisioning steps, in the same order begin() applied them.
+ * In flash, so they cost no RAM on AVR
+ */
+static const char provisionCmds[][7] PROGMEM = {"NAME", "TYPE", "APSSID", "APPSK", "PORT", "START"};
+static const char legacyProvisionCmds[][6] PROGMEM = {"NAME", "TYPE", "SSID", "PSK", "MODE", "PORT", "START"};
+static const char videoCmds[VIDEO_SETTING_COUNT][10] PROGMEM = {"FRAMESIZE", "QUALITY", "FPS", "STREAM", "VISION", "LAMP"};
+
+/**
+ * @brief Get the re-provisioning command for a step,
+ *        in the same order begin() applied them
+ *
+ * @param step index of the command
+ * @param command returned command keyword, in flash
+ * @param value returned command value
+ * @return false if there is no more step
+ */
+bool AiCamera::getProvisionCommand(uint8_t step, const char **command, const char **value)
+{
+  static char videoValue[4];
+  const char *values[] = {name, type, ssid, password, wsPort, ""};
+  const char *legacyValues[] = {name, type, ssid, password, wifiMode, wsPort, ""};
+  uint8_t videoValues[VIDEO_SETTING_COUNT] = {adaptFrameSize, adaptQuality, videoFrameRate, videoStream, visionMask, lampLevel};
+  uint8_t videoStep = getProvisionVideoStep();
+
+  if (step < videoStep)
+  {
+    *command = wifiMode == NULL ? provisionCmds[step] : legacyProvisionCmds[step];
+    *value = wifiMode == NULL ? values[step] : legacyValues[step];
+    return true;
+  }
+
+  // video and vision settings taken when the replay started, see provisionLoop()
+  step -= videoStep;
+  uint8_t i = 0;
+  for (uint8_t j = 0; j < VIDEO_SETTING_COUNT; j++)
+  {
+    if (!(provisionVideo & (1 << j)))
+      continue;
+    if (i == step)
+    {
+      itoa(videoValues[j], videoValue, 10);
+      *command = videoCmds[j];
+      *value = videoValue;
+      return true;
+    }
+    i++;
+  }
+  return false;
+}
+
+/**
+ * @brief Get the first re-provisioning step of the video settings
+ */
+uint8_t AiCamera::getProvisionVideoStep()
+{
+  if (wifiMode == NULL)
+  {
+    return sizeof(provisionCmds) / sizeof(provisionCmds[0]);
+  }
+  return sizeof(legacyProvisionCmds) / sizeof(legacyProvisionCmds[0]);
+}
+
+/**
+ * @brief Get the time to wait for [OK] of the current re-provisioning step
+ */
+uint32_t AiCamera::getProvisionTimeout()
+{
+  if (provisionState == PROVISION_SETTLE)
+  {
+    return provisionDelay;
+  }
+  // START is the last step before the video settings
+  return provisionStep + 1 == getProvisionVideoStep() ? PROVISION_START_TIMEOUT : PROVISION_TIMEOUT;
+}
+
+/**
+ * @brief Send the current re-provisioning command without waiting for [OK]
+ */
+void AiCamera::provisionSend()
+{
+  const char *command;
+  const char *value;
+  if (!getProvisionCommand(provisionStep, &command, &value))
+  {
+    return;
+  }
+  // runs in the pump, so written to DataSerial directly even in task mode
+  this->writeCommand(DataSerial, (const __FlashStringHelper *)command, value);
+  provisionTime = millis();
+}
+
+/**
+ * @brief Advance the re-provisioning state machine on timeouts,
+ *        called from loop() so it never blocks
+ */
+void AiCamera::provisionLoop()
+{
+  if (provisionState == PROVISION_SETTLE)
+  {
+    // same settle time as begin() after RESET, longer after a failed replay
+    if (millis() - provisionTime >= provisionDelay)
+    {
+      provisionState = PROVISION_RUN;
+      provisionStep = 0;
+      provisionRetry = 0;
+      // the steps are fixed here, settings made during the replay follow it
+      provisionVideo = STATE_ACQUIRE(videoSettings);
+      STATE_TAKE_BITS(provisionPending);
+      this->provisionSend();
+    }
+  }
+  else if (provisionState == PROVISION_RUN)
+  {
+    if (millis() - provisionTime >= getProvisionTimeout())
+    {
+      provisionRetry++;
+      if (provisionRetry >= PROVISION_RETRY_COUNT)
+      {
+        // camera did not answer, start over from the first command, waiting
+        // twice as long each time. Not reported on DebugSerial, which is
+        // DataSerial on some boards
+        provisionState = PROVISION_SETTLE;
+        provisionTime = millis();
+        provisionDelay = min(provisionDelay * 2UL, (uint32_t)PROVISION_BACKOFF_MAX);
+        return;
+      }
+      this->provisionSend();
+    }
+  }
+}
+
+/**
+ * @brief Handle [OK] of a re-provisioning command and send the next one
+ */
+void AiCamera::provisionAck()
+{
+  const char *command;
+  const char *value;
+  DataSerial.println(F(OK_FLAG));
+  provisionStep++;
+  provisionRetry = 0;
+  if (!getProvisionCommand(provisionStep, &command, &value))
+  {
+    // then the video settings made while replaying, with their latest values
+    provisionVideo = STATE_TAKE_BITS(provisionPending);
+    provisionStep = getProvisionVideoStep();
+  }
+  if (getProvisionCommand(provisionStep, &command, &value))
+  {
+    this->provisionSend();
+    return;
+  }
+  provisionState = PROVISION_IDLE;
+  recoveryTime = millis() - rebootTime;
+  recoveryCount++;
+}
+
+/**
+ * @brief Whether the configuration is being replayed after an ESP32-CAM reboot
+ */
+bool AiCamera::isProvisioning()
+{
+  return provisionState != PROVISION_IDLE;
+}
+
+/**
+ * @brief Time from the last ESP32-CAM reboot ([Init]) until its configuration
+ *        was fully restored, in ms. 0 if the camera never rebooted
+ */
+uint32_t AiCamera::getRecoveryTime()
+{
+  return recoveryTime;
+}
+
+/**
+ * @brief Number of ESP32-CAM reboots recovered from since begin()
+ */
+uint16_t AiCamera::getRecoveryCount()
+{
+  return recoveryCount;
+}
+
+/**
+ * @brief Time left until a timeout started at `since` expires, in ms
+ */
+static uint32_t timeLeft(uint32_t since, uint32_t timeout)
+{
+  uint32_t elapsed = millis() - since;
+  return elapsed >= timeout ? 0 : timeout - elapsed;
+}
+
+/**
+ * @brief Time until loop() has something to do on its own, in ms.
+ *        Received data is handled as soon as it arrives, so the
+ *        telemetry interval does not count here: autoSend only sends
+ *        after receiving. Returns 0 if data is waiting on DataSerial,
+ *        IDLE_FOREVER if nothing is scheduled. In task mode the pump task
+ *        and the app only count their own work, and only the pump task
+ *        looks at DataSerial
+ */
+uint32_t AiCamera::getNextDeadline()
+{
+  uint32_t deadline = IDLE_FOREVER;
+  bool pumpSide = this->inPump();
+  bool appSide = !taskMode || !pumpSide;
+  if (pumpSide)
+  {
+    if (DataSerial.available())
+    {
+      return 0;
+    }
+#ifdef AI_CAM_TASK
+    if (taskMode && !txQueue.isEmpty())
+    {
+      return 0;
+    }
+#endif
+    if (provisionState != PROVISION_IDLE)
+    {
+      deadline = min(deadline, timeLeft(provisionTime, getProvisionTimeout()));
+    }
+#if BULK_TRANSFER
+    else if (STATE_ACQUIRE(bulkState) == BULK_BUSY)
+    {
+      if (bulkNext < bulkChunks && bulkNext - bulkBase < BULK_WINDOW)
+      {
+        // chunk airtime left, rounded up to whole ms
+        uint32_t elapsed = micros() - bulkTxTime;
+        uint32_t airtime = BULK_FRAME_LENGTH * 1000000UL / BULK_LINE_RATE;
+        deadline = min(deadline, elapsed >= airtime ? 0 : (airtime - elapsed + 999) / 1000);
+      }
+      deadline = min(deadline, timeLeft(bulkTime, BULK_TIMEOUT));
+    }
+#endif
+#if SNAPSHOT_TRANSFER
+    if (STATE_ACQUIRE(snapState) == SNAPSHOT_BUSY)
+    {
+      deadline = min(deadline, timeLeft(snapTime, SNAPSHOT_TIMEOUT));
+    }
+#endif
+#if RATE_CONTROL
+    if (rateControl && ws_connected)
+    {
+      deadline = min(deadline, timeLeft(pingTime, RATE_PING_INTERVAL));
+    }
+#endif
+  }
+  if (appSide)
+  {
+    if (this->handedOver())
+    {
+      return 0;
+    }
+    if (paramDirty && ws_connected)
+    {
+      deadline = 0;
+    }
+    if (paramSavePending)
+    {
+      deadline = min(deadline, timeLeft(paramSaveTime, PARAM_SAVE_DELAY));
+    }
+    if (failsafeTimeout != 0 && !failsafeActive)
+    {
+      deadline = min(deadline, timeLeft(*failsafeInput, failsafeTimeout));
+    }
+#if VIDEO_ADAPTIVE
+    if (videoAdaptive && (adaptFrameSize != videoFrameSize || adaptQuality > videoQuality))
+    {
+      deadline = min(deadline, timeLeft(congestionTime, VIDEO_RECOVER_TIME));
+      deadline = min(deadline, timeLeft(adaptTime, VIDEO_ADAPT_INTERVAL));
+    }
+#endif
+  }
+  return deadline;
+}
+
+/**
+ * @brief Whether the pump task handed over a control frame or a parameter
+ *        message loop() has not taken yet, always false outside task mode
+ */
+bool AiCamera::handedOver()
+{
+#ifdef AI_CAM_TASK
+  if (!taskMode)
+  {
+    return false;
+  }
+#if PARAM_SLOT_COUNT > 0
+  if (!paramQueue.isEmpty())
+  {
+    return true;
+  }
+#endif
+  return controlSnapshot.changed(appSeq);
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Sleep until the next deadline or until DataSerial receives data,
+ *        in task mode until the pump task hands over a frame.
+ *        Call it at the end of the sketch loop() instead of busy polling
+ *
+ * @param maxTime longest time to sleep in ms, e.g. until the sketch's own next task
+ *
+ * @code {.cpp}
+ * void loop() {
+ *   aiCam.loop();
+ *   aiCam.idle(20);
+ * }
+ * @endcode
+ */
+void AiCamera::idle(uint32_t maxTime)
+{
+  uint32_t timeout = getNextDeadline();
+  if (maxTime < timeout)
+  {
+    timeout = maxTime;
+  }
+  if (timeout == 0)
+  {
+    return;
+  }
+
+  uint32_t st = millis();
+#ifdef AI_CAM_TASK
+  // onIdle belongs to the sketch, the pump task only waits for DataSerial
+  bool sketchSide = !taskMode || !this->inPump();
+#else
+  bool sketchSide = true;
+#endif
+  if (__onIdle__ != NULL && sketchSide)
+  {
+    __onIdle__(timeout);
+  }
+#ifdef AI_CAM_TASK
+  else if (taskMode && !this->inPump())
+  {
+    // DataSerial belongs to the pump task, wait for what it hands over
+    while (!this->handedOver() && (millis() - st) < timeout)
+    {
+      delay(1);
+    }
+  }
+#endif
+  else
+  {
+    while (!DataSerial.available() && !this->pumpWoken() && (millis() - st) < timeout)
+    {
+#if defined(__AVR__)
+      // Idle mode keeps the UART and timer0 running, RX or the millis() tick wakes the CPU
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      sleep_mode();
+#elif defined(__arm__)
+      __WFI();
+#elif defined(__linux__)
+      // sleep in epoll until the tty is readable
+      CameraSerial.wait(timeout - (millis() - st));
+#else
+      delay(1);
+#endif
+    }
+  }
+  idleTime += millis() - st;
+}
+
+/**
+ * @brief Total time spent sleeping in idle(), in ms
+ */
+uint32_t AiCamera::getIdleTime()
+{
+  return idleTime;
+}
+
+/**
+ * @brief Print the information received from esp32-CAm,
+ *        according to the set of CAM_DEBUG_LEVEL
+ *
+ * @param msg Message to be detected
+ */
+void AiCamera::debug(char *msg)
+{
+#if (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_ALL) // all
+  DebugSerial.println(msg);
+#elif (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_ERROR) // error
+  if (IsStartWith(msg, CAM_DEBUG_HEAD_ERROR))
+  {
+    DebugSerial.println(msg);
+  }
+#elif (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_INFO)  // info
+  if (IsStartWith(msg, CAM_DEBUG_HEAD_ERROR))
+  {
+    DebugSerial.println(msg);
+  }
+  else if (IsStartWith(msg, CAM_DEBUG_HEAD_INFO))
+  {
+    DebugSerial.println(msg);
+  }
+#elif (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_DEBUG) // debug
+  if (IsStartWith(msg, CAM_DEBUG_HEAD_ERROR))
+  {
+    DebugSerial.println(msg);
+  }
+  else if (IsStartWith(msg, CAM_DEBUG_HEAD_INFO))
+  {
+    DebugSerial.println(msg);
+  }
+  else if (IsStartWith(msg, CAM_DEBUG_HEAD_DEBUG))
+  {
+    DebugSerial.println(msg);
+  }
+#endif
+}
+
+/**
+ * @brief Store the data read from the serial port into the buffer.
+ *        Returns as soon as the serial port has no more data, and carries
+ *        on with the same frame on the next call. A frame that gets no
+ *        byte for CHAR_TIMEOUT is abandoned, e.g. when ESP32-CAM reboots
+ *
+ * @param buffer  Pointer to the String value of the stored data, the same
+ *                buffer on every call
+ * @return true if a whole frame was received
+ */
+bool AiCamera::readInto(char *buffer)
+{
+  /* !!! attention buffer size*/
+  bool finished = false;
+  uint8_t inchar;
+
+  if (rxCount > 0 && millis() - rxTime > CHAR_TIMEOUT)
+  {
+    if (rxBinary)
+    {
+      droppedBinary++;
+    }
+    rxCount = 0;
+  }
+  if (rxCount == 0)
+  {
+    StrClear(buffer);
+    rxBinary = false;
+    rxBinaryByteCount = 0;
+  }
+
+  // recv Byte
+  while (DataSerial.available())
+  {
+    rxTime = millis();
+    rxCount += 1;
+    if (rxCount > WS_BUFFER_SIZE)
+    {
+      if (rxBinary)
+      {
+        // longer than WS_BIN_PAYLOAD_SIZE, drop it rather than pass on a cut payload
+        StrClear(buffer);
+        droppedBinary++;
+        rxCount = 0;
+        return false;
+      }
+      finished = true;
+      break;
+    }
+    inchar = (uint8_t)DataSerial.read();
+    if (rxBinary)
+    {
+      // Start Byte
+      // DebugSerial.print(rxBinaryByteCount);
+      // DebugSerial.print(F(": 0x"));DebugSerial.println(inchar, HEX);
+      if (rxBinaryByteCount == 0)
+      {
+        if (inchar == BIN_START_BYTE)
+        {
+          // DebugSerial.println("binary start");
+          StrClear(buffer);
+          rxBinaryByteCount = 1;
+          continue;
+        }
+        else
+        {
+          DebugSerial.print(F("binary start byte error: 0x"));
+          DebugSerial.println(inchar, HEX);
+          continue;
+        }
+      } // Length Byte
+      else if (rxBinaryByteCount == 1)
+      {
+        rxBinaryLength = inchar;
+        // DebugSerial.print(F("data length: "));DebugSerial.println(rxBinaryLength);
+      } // Checksum Byte
+      else if (rxBinaryByteCount == 2)
+      {
+        rxBinaryChecksum = inchar;
+        // DebugSerial.print(F("checksum: "));DebugSerial.println(rxBinaryChecksum);
+      } // End Byte
+      else if (rxBinaryByteCount == rxBinaryLength + 3)
+      {
+        if (inchar != BIN_END_BYTE)
+        {
+          DebugSerial.println(F("end byte error"));
+          continue;
+        }
+        // DebugSerial.println(F("binary end byte"));
+        uint8_t checksum = buffer[0];
+        for (uint8_t i = 1; i < rxBinaryLength; i++)
+        {
+          checksum ^= buffer[i];
+        }
+        if (checksum != rxBinaryChecksum)
+        {
+          DebugSerial.print(F("checksum error, expect: "));
+          DebugSerial.print(checksum);
+          DebugSerial.print(", actual: ");
+          DebugSerial.println(rxBinaryChecksum);
+          continue;
+        }
+        finished = true;
+        break;
+      } // Data Byte
+      else
+      {
+        uint8_t index = rxBinaryByteCount - 3;
+        // DebugSerial.print("index: ");DebugSerial.print(index);
+        // DebugSerial.print(", data: 0x");DebugSerial.println(inchar, HEX);
+        buffer[index] = inchar;
+      }
+      rxBinaryByteCount += 1;
+    }
+    else
+    {
+      if (inchar == '\n')
+      {
+        finished = true;
+        break;
+      }
+      else if (inchar == '\r')
+      {
+        continue;
+      }
+      else if ((int)inchar > 31 && (int)inchar < 127)
+      {
+        StrAppend(buffer, inchar);
+        if (IsStartWith(buffer, WS_BIN_HEADER))
+        {
+          // DebugSerial.println("binary data start");
+          rxBinary = true;
+        }
+      }
+    }
+  }
+
+  if (!finished)
+  {
+    return false;
+  }
+  // the next call starts a new frame
+  rxCount = 0;
+
+  // if recv debug info
+  if (rxBinary)
+  {
+    recvBufferType = WS_BUFFER_TYPE_BINARY;
+    recvBufferLength = rxBinaryLength;
+  }
+  else
+  {
+    debug(buffer);
+    recvBufferType = WS_BUFFER_TYPE_TEXT;
+  }
+  if (IsStartWith(buffer, CAM_DEBUG_HEAD_DEBUG))
+  {
+#if (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_DEBUG) // all
+    DebugSerial.print(CAM_DEBUG_HEAD_DEBUG);
+    DebugSerial.println(buffer);
+#endif
+    StrClear(buffer);
+  }
+  return true;
+}
+
+/**
+ * @brief Serial port sends data, automatically adds header (WS_HEADER)
+ */
+void AiCamera::sendData()
+{
+  uint32_t st = micros();
+  uint32_t dueMask = this->getDueRegions();
+  this->packAggregates(dueMask);
+  Print &out = this->txBegin();
+  out.print(F(WS_HEADER));
+  // sendDoc["A"] = 0;
+  if (rateCount == 0)
+  {
+    serializeJson(sendDoc, out);
+  }
+  else
+  {
+    // only the keys that are due, keys other than "A" to "Z" are always sent
+    bool first = true;
+    out.print('{');
+    for (JsonPairConst kv : sendDoc.as<JsonObjectConst>())
+    {
+      const char *key = kv.key().c_str();
+      if (key[0] >= 'A' && key[0] <= 'Z' && key[1] == '\0' && !(dueMask & (1UL << (key[0] - 'A'))))
+      {
+        continue;
+      }
+      if (!first)
+      {
+        out.print(',');
+      }
+      first = false;
+      out.print('"');
+      out.print(key);
+      out.print(F("\":"));
+      serializeJson(kv.value(), out);
+    }
+    out.print('}');
+  }
+  out.print("\n");
+#if RATE_CONTROL
+  telemetryWriteTime = micros() - st;
+#endif
+  this->txEnd(st);
+}
+
+/**
+ * @brief Send telemetry after receiving, at most every wsSendInterval
+ */
+void AiCamera::autoSendData()
+{
+  if (!this->autoSend || provisionState != PROVISION_IDLE)
+  {
+    return;
+  }
+#if RATE_CONTROL
+  if (rateControl && !ws_connected)
+  {
+    return;
+  }
+#endif
+  if (millis() - wsSendTime > wsSendInterval)
+  {
+    this->sendData();
+    wsSendTime = millis();
+    this->rateUpdate();
+  }
+}
+
+/**
+ * @brief Adapt the telemetry interval between `minInterval` and `maxInterval`
+ *        to the link: it doubles when the link is congested, and shrinks
+ *        by RATE_STEP ms per send otherwise. Congested means writing
+ *        telemetry blocks for more than half the interval (or the TX queue
+ *        is half full in task mode), or the ping round trip to ESP32-CAM
+ *        exceeds RATE_RTT_LIMIT. Telemetry stops while the app is not connected.
+ *        Without RATE_CONTROL, the default on AVR, the interval is fixed
+ *        to `minInterval`
+ *
+ * @param minInterval shortest interval in ms, at least 1
+ * @param maxInterval longest interval in ms
+ *
+ * @code {.cpp}
+ * aiCam.setSendRate(50, 1000);
+ * Serial.println(aiCam.getSendInterval());
+ * @endcode
+ */
+void AiCamera::setSendRate(uint16_t minInterval, uint16_t maxInterval)
+{
+  // 0 would never grow when doubled
+  minInterval = max(minInterval, (uint16_t)1);
+#if RATE_CONTROL
+  rateControl = true;
+  rateMin = minInterval;
+  rateMax = max(minInterval, maxInterval);
+  // the pump starts pinging
+  this->wakePump();
+#else
+  (void)maxInterval;
+#endif
+  wsSendInterval = minInterval;
+}
+
+/**
+ * @brief Update the telemetry interval after a send
+ */
+void AiCamera::rateUpdate()
+{
+#if RATE_CONTROL
+  if (!rateControl)
+  {
+    return;
+  }
+  bool congested = telemetryWriteTime / 1000 > (uint32_t)wsSendInterval / 2;
+#ifdef AI_CAM_TASK
+  if (taskMode && txQueue.used() > TX_QUEUE_SIZE / 2)
+  {
+    congested = true;
+  }
+#endif
+  // only once ESP32-CAM answered a ping, older firmware does not
+  if (STATE_ACQUIRE(pongSeen) &&
+      (STATE_ACQUIRE(linkRtt) > RATE_RTT_LIMIT || millis() - STATE_ACQUIRE(pongTime) > 3 * RATE_PING_INTERVAL))
+  {
+    congested = true;
+  }
+
+  if (congested)
+  {
+    wsSendInterval = min(wsSendInterval * 2, (int32_t)rateMax);
+    this->reportCongestion();
+  }
+  else
+  {
+    wsSendInterval = max(wsSendInterval - RATE_STEP, (int32_t)rateMin);
+  }
+#endif
+}
+
+/**
+ * @brief Forget the last pong on [Init] and when the app connects, so one
+ *        from before does not count as a stale link, called from the pump
+ */
+void AiCamera::pongReset()
+{
+#if RATE_CONTROL
+  STATE_PUBLISH(pongSeen, false);
+  STATE_PUBLISH(linkRtt, (uint16_t)0);
+#endif
+}
+
+/**
+ * @brief Ping ESP32-CAM to measure the link round trip, called from the pump
+ */
+void AiCamera::pingLoop()
+{
+#if RATE_CONTROL
+  if (!rateControl || !ws_connected || millis() - pingTime < RATE_PING_INTERVAL)
+  {
+    return;
+  }
+  pingTime = millis();
+  uint8_t ping[5] = {BIN_TYPE_PING, (uint8_t)pingTime, (uint8_t)(pingTime >> 8),
+                     (uint8_t)(pingTime >> 16), (uint8_t)(pingTime >> 24)};
+  DataSerial.print(F(WS_BIN_HEADER));
+  DataSerial.write(ping, sizeof(ping));
+  DataSerial.print("\n");
+#endif
+}
+
+/**
+ * @brief Telemetry interval in ms, chosen by the rate controller
+ */
+uint16_t AiCamera::getSendInterval()
+{
+  return wsSendInterval;
+}
+
+/**
+ * @brief Round trip of the last ping to ESP32-CAM in ms, 0 if never answered
+ *        or without RATE_CONTROL
+ */
+uint16_t AiCamera::getLinkRtt()
+{
+#if RATE_CONTROL
+  return STATE_ACQUIRE(linkRtt);
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Send a region at its own period instead of with every sendData(),
+ *        e.g. battery voltage every 5 s while the radar goes every 60 ms.
+ *        Regions without a period are sent every time
+ *
+ * @param region the key of component
+ * @param interval period in ms, rounded up to the sendData() cycle
+ * @param jitter up to this many ms are randomly added to each period,
+ *               so slow regions do not all fall into the same frame
+ * @return false if all RATE_SLOT_COUNT slots are used, always on AVR
+ *         unless RATE_SLOT_COUNT is set
+ *
+ * @code {.cpp}
+ * aiCam.setSendInterval(REGION_B, 5000, 500); // battery
+ * aiCam.sendDoc["B"] = batteryVoltage();
+ * @endcode
+ */
+bool AiCamera::setSendInterval(uint8_t region, uint16_t interval, uint16_t jitter)
+{
+#if RATE_SLOT_COUNT > 0
+  AiCameraRate *slot = NULL;
+  if (region > REGION_Z)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < rateCount; i++)
+  {
+    if (rateSlots[i].region == region)
+    {
+      slot = &rateSlots[i];
+    }
+  }
+  if (slot == NULL)
+  {
+    if (rateCount >= RATE_SLOT_COUNT)
+    {
+      return false;
+    }
+    slot = &rateSlots[rateCount++];
+    slot->region = region;
+  }
+  slot->interval = interval;
+  slot->jitter = jitter;
+  slot->nextTime = millis();
+  return true;
+#else
+  (void)region;
+  (void)interval;
+  (void)jitter;
+  return false;
+#endif
+}
+
+/**
+ * @brief Get the regions to be sent now, and schedule their next send
+ *
+ * @return bit n set if REGION_n is due
+ */
+uint32_t AiCamera::getDueRegions()
+{
+  uint32_t dueMask = REGION_ALL_MASK;
+#if RATE_SLOT_COUNT > 0
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < rateCount; i++)
+  {
+    AiCameraRate *slot = &rateSlots[i];
+    if ((int32_t)(now - slot->nextTime) < 0)
+    {
+      dueMask &= ~(1UL << slot->region);
+      continue;
+    }
+    slot->nextTime = now + slot->interval;
+    if (slot->jitter > 0)
+    {
+      slot->nextTime += random(slot->jitter + 1);
+    }
+  }
+#endif
+  return dueMask;
+}
+
+/**
+ * @brief Send binary data
+ *
+ * @param data binary data
+ * @param len data length
+ */
+void AiCamera::sendBinaryData(uint8_t *data, size_t len)
+{
+  uint32_t st = micros();
+  Print &out = this->txBegin();
+  out.print(F(WS_BIN_HEADER));
+  out.write(data, len);
+  out.print("\n");
+  this->txEnd(st);
+}
+
+/**
+ * @brief Record the latency of a frame written to DataSerial
+ *
+ * @param lane TX_LANE_URGENT or TX_LANE_BULK
+ * @param since micros() when the frame was ready to send
+ */
+void AiCamera::txDone(uint8_t lane, uint32_t since)
+{
+#if TX_LANE_STATS
+  uint32_t latency = micros() - since;
+  laneStats[lane].frames++;
+  laneStats[lane].totalLatency += latency;
+  if (latency > laneStats[lane].maxLatency)
+  {
+    laneStats[lane].maxLatency = latency;
+  }
+#else
+  (void)lane;
+  (void)since;
+#endif
+}
+
+/**
+ * @brief Get the TX statistics of a priority lane. For urgent frames the
+ *        latency is the time to write the frame, including waiting for
+ *        bulk bytes still in the TX buffer, and in task mode the time in
+ *        the TX queue. For bulk chunks it is the time from the window
+ *        allowing the chunk until it is written. All zero when
+ *        TX_LANE_STATS is 0
+ *
+ * @param lane TX_LANE_URGENT or TX_LANE_BULK
+ *
+ * @code {.cpp}
+ * const AiCameraLaneStats *stats = aiCam.getLaneStats(TX_LANE_URGENT);
+ * Serial.println(stats->totalLatency / max(stats->frames, (uint32_t)1)); // average in us
+ * Serial.println(stats->maxLatency);
+ * @endcode
+ */
+const AiCameraLaneStats *AiCamera::getLaneStats(uint8_t lane)
+{
+#if TX_LANE_STATS
+  return &laneStats[lane];
+#else
+  static const AiCameraLaneStats none = {};
+  (void)lane;
+  return &none;
+#endif
+}
+
+void AiCamera::resetLaneStats()
+{
+#if TX_LANE_STATS
+  memset(laneStats, 0, sizeof(laneStats));
+#endif
+}
+
+/**
+ * @brief Set command timeout
+ *
+ * @param _timeout timeout value
+ */
+void AiCamera::setCommandTimeout(uint32_t _timeout)
+{
+  cmdTimeout = _timeout;
+}
+
+/**
+ * @brief Send command to ESP32-CAM with serial
+ *
+ * @param command command keyword
+ * @param value
+ * @param result returned information from serial
+ * @param size size of result, a longer reply is cut
+ */
+void AiCamera::command(const char *command, const char *value, char *result, uint8_t size, bool wait)
+{
+  bool is_ok = false;
+  uint8_t retry_count = 0;
+  uint8_t retryMaxCount = 3;
+
+  // in task mode only the pump reads DataSerial, the app can not wait for [OK]
+  wait = wait && this->inPump();
+  while (retry_count < retryMaxCount)
+  {
+    uint32_t txTime = micros();
+    if (this->inPump())
+    {
+      DataSerial.flush();
+    }
+    if (!wait && provisionState != PROVISION_IDLE)
+    {
+      // the re-provisioning replay takes every [OK] as the answer to its
+      // current step, so nothing else may be sent until it is done
+      return;
+    }
+    this->writeCommand(this->txBegin(), command, value);
+    this->txEnd(txTime);
+    if (!wait)
+      return; // if not waiting, return immediately
+
+    retry_count++;
+
+    uint32_t st = millis();
+    while ((millis() - st) < cmdTimeout)
+    {
+      // if (recvBuffer[0] == 0) continue;
+      // DebugSerial.println(recvBuffer);
+      if (this->readInto(recvBuffer) && IsStartWith(recvBuffer, OK_FLAG))
+      {
+        is_ok = true;
+        DataSerial.println(F(OK_FLAG));
+        this->subString(recvBuffer, strlen(OK_FLAG) + 1); // Add 1 for Space
+        strncpy(result, recvBuffer, size - 1);
+        result[size - 1] = '\0';
+        break;
+      }
+    }
+
+    if (is_ok == true)
+    {
+      break;
+    }
+  }
+
+  if (is_ok == false)
+  {
+    Serial.println(F("[FAIL]"));
+    while (1)
+      ;
+  }
+  DataSerial.flush();
+}
+
+/**
+ * @brief Write a SET+ command
+ *
+ * @param out DataSerial, or the TX queue in task mode
+ * @param command command keyword
+ * @param value
+ */
+void AiCamera::writeCommand(Print &out, const char *command, const char *value)
+{
+  out.print(F("SET+"));
+  out.print(command);
+  out.println(value);
+  out.print(F("..."));
+}
+
+void AiCamera::writeCommand(Print &out, const __FlashStringHelper *command, const char *value)
+{
+  out.print(F("SET+"));
+  out.print(command);
+  out.println(value);
+  out.print(F("..."));
+}
+
+/**
+ * @brief Send a command without waiting for [OK], like set(command, value, false)
+ *        with the keyword in flash
+ *
+ * @param command command keyword, F("...") or from a PROGMEM table
+ * @param value
+ */
+void AiCamera::sendCommand(const __FlashStringHelper *command, const char *value)
+{
+  uint32_t txTime = micros();
+  if (provisionState != PROVISION_IDLE)
+  {
+    // see command()
+    return;
+  }
+  this->writeCommand(this->txBegin(), command, value);
+  this->txEnd(txTime);
+}
+
+/**
+ * @brief Use the comand() function to set up the ESP32-CAM
+ *
+ * @param command command keyword
+ */
+void AiCamera::set(const char *command, bool wait)
+{
+  char result[10];
+  this->command(command, "", result, sizeof(result), wait);
+}
+
+/**
+ * @brief Use the comand() function to set up the ESP32-CAM
+ *
+ * @param command command keyword
+ * @param value
+ *
+ * @code {.cpp}
+ * set("NAME", "Zeus_Car");
+ * set("TYPE", "Zeus_Car");
+ * set("SSID", "Zeus_Car");
+ * set("PSK",  "12345678");
+ * set("MODE", WIFI_MODE_AP);
+ * set("PORT", "8765");
+ * @endcode
+ *
+ */
+void AiCamera::set(const char *command, const char *value, bool wait)
+{
+  char result[10];
+  this->command(command, value, result, sizeof(result), wait);
+}
+
+/**
+ * @brief Use the comand() function to set up the ESP32-CAM,
+ *        and receive return information
+ *
+ * @param command command keyword
+ * @param result returned information from serial
+ * @param size size of result
+ * @code {.cpp}
+ * char ip[REPLY_SIZE];
+ * get("START", ip, sizeof(ip));
+ * @endcode
+ */
+void AiCamera::get(const char *command, char *result, uint8_t size)
+{
+  this->command(command, "", result, size);
+}
+
+/**
+ * @brief Use the comand() function to set up the ESP32-CAM,
+ *        and receive return information
+ *
+ * @param command command keyword
+ * @param value
+ * @param result returned information from serial
+ * @param size size of result
+ */
+void AiCamera::get(const char *command, const char *value, char *result, uint8_t size)
+{
+  this->command(command, value, result, size);
+}
+
+/**
+ * @brief Interpret the value of the slider contorl component from the buf string
+ *
+ * @param buf string pointer to be interpreted
+ * @param region the key of component
+ * @return the value of the slider contorl component
+ */
+int16_t AiCamera::getSlider(uint8_t region)
+{
+  int16_t value = getIntOf(ctrlBuffer(), region);
+  return value;
+}
+
+/**
+ * @brief Interpret the value of the Button component from the buf string
+ *
+ * @param buf string pointer to be interpreted
+ * @param region the key of component
+ * @return the value of the Joystick component
+ *        - true
+ *        - flase
+ */
+bool AiCamera::getButton(uint8_t region)
+{
+  bool value = getBoolOf(ctrlBuffer(), region);
+  return value;
+}
+
+/**
+ * @brief Interpret the value of the getSwitch component from the buf string
+ *
+ * @param buf string pointer to be interpreted
+ * @param region the key of component
+ * @return the value of the Joystick component
+ *        - true
+ *        - flase
+ */
+bool AiCamera::getSwitch(uint8_t region)
+{
+  bool value = getBoolOf(ctrlBuffer(), region);
+  return value;
+}
+
+/**
+ * @brief Interpret the value of the Joystick component from the buf string
+ *
+ * @param buf string pointer to be interpreted
+ * @param region the key of component
+ * @param axis which type of value that you want,
+ *             could be JOYSTICK_X, JOYSTICK_Y, JOYSTICK_ANGLE, JOYSTICK_RADIUS
+ * @return the value of the Joystick component
+ */
+int16_t AiCamera::getJoystick(uint8_t region, uint8_t axis)
+{
+  char valueStr[VALUE_SIZE];
+  int16_t x, y, angle, radius;
+  getStrOf(ctrlBuffer(), region, valueStr, ';', sizeof(valueStr));
+  x = getIntOf(valueStr, 0, ',');
+  y = getIntOf(valueStr, 1, ',');
+  angle = atan2(x, y) * 180.0 / PI;
+  radius = sqrt(y * y + x * x);
+  switch (axis)
+  {
+  case JOYSTICK_X:
+    return x;
+  case JOYSTICK_Y:
+    return y;
+  case JOYSTICK_ANGLE:
+    return angle;
+  case JOYSTICK_RADIUS:
+    return radius;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief Interpret the value of the DPad component from the buf string
+ *
+ * @param buf string pointer to be interpreted
+ * @param region the key of component
+ *
+ * @return the value of the DPadDPad component,
+ *         it could be null, "forward", "backward", "left", "stop"
+ */
+uint8_t AiCamera::getDPad(uint8_t region)
+{
+  char value[VALUE_SIZE];
+  getStrOf(ctrlBuffer(), region, value, ';', sizeof(value));
+  uint8_t result = DPAD_STOP;
+  if (strcmp(value, "forward") == 0)
+    result = DPAD_FORWARD;
+  else if (strcmp(value, "backward") == 0)
+    result = DPAD_BACKWARD;
+  else if (strcmp(value, "left") == 0)
+    result = DPAD_LEFT;
+  else if (strcmp(value, "right") == 0)
+    result = DPAD_RIGHT;
+  return result;
+}
+
+/**
+ * @brief Interpret the value of the Throttle component from the buf string
+ *
+ * @param buf string pointer to be interpreted
+ * @param region the key of component
+ *
+ * @return the value of the Throttle component,
+ */
+int16_t AiCamera::getThrottle(uint8_t region)
+{
+  int16_t value = getIntOf(ctrlBuffer(), region);
+  return value;
+}
+
+/**
+ * @brief Interpret the value of the Speech component from the buf string
+ *
+ * @param buf string pointer to be interpreted
+ * @param region the key of component
+ * @param result char array pointer to hold the result
+ * @param size size of result, longer text is truncated
+ * @return the value of the Joystick component
+ */
+void AiCamera::getSpeech(uint8_t region, char *result, uint8_t size)
+{
+  getStrOf(ctrlBuffer(), region, result, ';', size);
+}
+
+/**
+ * @brief Scale a value to the sample unit of an aggregating region,
+ *        the statistic is divided by `divider` again when sent
+ */
+static int32_t toSample(double value, uint16_t divider)
+{
+  return (int32_t)(value * divider + (value < 0 ? -0.5 : 0.5));
+}
+
+/**
+ * @brief Fill the value of Meter display component into the buf to be sent
+ *
+ * @param region the key of component
+ * @param value the value to be filled
+ */
+void AiCamera::setMeter(uint8_t region, double value)
+{
+  AiCameraAggregate *slot = aggCount > 0 ? getAggregate(region) : NULL;
+  if (slot != NULL)
+  {
+    addSample(region, toSample(value, slot->divider));
+    return;
+  }
+  setStrOf(ctrlBuffer(), region, String(value));
+}
+
+/**
+ * @brief Fill the value of Radar display component into the buf to be sent
+ *
+ * @param region the key of component
+ * @param angle the orientation of the obstacle
+ * @param distance the distance of the obstacle
+ */
+void AiCamera::setRadar(uint8_t region, int16_t angle, double distance)
+{
+  setStrOf(ctrlBuffer(), region, String(angle) + "," + String(distance));
+}
+
+/**
+ * @brief Fill the value of 3-way grayscale display component into the buf to be sent
+ *
+ * @param region the key of component
+ * @param value1
+ * @param value2
+ * @param value3
+ */
+void AiCamera::setGreyscale(uint8_t region, uint16_t value1, uint16_t value2, uint16_t value3)
+{
+  setStrOf(ctrlBuffer(), region, String(value1) + "," + String(value2) + "," + String(value3));
+}
+
+void AiCamera::setValue(uint8_t region, double value)
+{
+  AiCameraAggregate *slot = aggCount > 0 ? getAggregate(region) : NULL;
+  if (slot != NULL)
+  {
+    addSample(region, toSample(value, slot->divider));
+    return;
+  }
+  setStrOf(ctrlBuffer(), region, String(value));
+}
+
+/**
+ * @brief Aggregate the samples of a region between two sendData(),
+ *        instead of sending only the last one. setValue(), setMeter()
+ *        and addSample() on the region then only update the statistics,
+ *        the value is formatted into sendDoc once per send. setValue() and
+ *        setMeter() take the value as sent and scale it by `divider`
+ *
+ * @param region the key of component
+ * @param mode statistic to send: AGG_LAST, AGG_MIN, AGG_MAX, AGG_MEAN or AGG_COUNT
+ * @param divider the statistic is divided by it when sent, e.g. 1000 for mA to A
+ * @return false if all AGG_SLOT_COUNT slots are used, always on AVR
+ *         unless AGG_SLOT_COUNT is set
+ *
+ * @code {.cpp}
+ * aiCam.setAggregate(REGION_C, AGG_MAX, 1000);
+ * // in a fast loop
+ * aiCam.addSample(REGION_C, readCurrent_mA());
+ * @endcode
+ */
+bool AiCamera::setAggregate(uint8_t region, uint8_t mode, uint16_t divider)
+{
+  AiCameraAggregate *slot = getAggregate(region);
+  if (region > REGION_Z)
+  {
+    return false;
+  }
+  if (slot == NULL)
+  {
+#if AGG_SLOT_COUNT > 0
+    if (aggCount >= AGG_SLOT_COUNT)
+    {
+      return false;
+    }
+    slot = &aggSlots[aggCount++];
+    memset(slot, 0, sizeof(AiCameraAggregate));
+    slot->region = region;
+#else
+    return false;
+#endif
+  }
+  slot->mode = mode;
+  slot->divider = divider == 0 ? 1 : divider;
+  return true;
+}
+
+/**
+ * @brief Add a sample to an aggregating region, integer work only
+ *
+ * @param region the key of component, set with setAggregate()
+ * @param value the sample
+ */
+void AiCamera::addSample(uint8_t region, int32_t value)
+{
+  AiCameraAggregate *slot = getAggregate(region);
+  if (slot == NULL)
+  {
+    return;
+  }
+  if (slot->count == 0 || value < slot->min)
+    slot->min = value;
+  if (slot->count == 0 || value > slot->max)
+    slot->max = value;
+  slot->last = value;
+  // sum and count stop together, the mean is over the first 65535 samples
+  if (slot->count < 0xFFFF)
+  {
+    slot->sum += value;
+    slot->count++;
+  }
+}
+
+/**
+ * @brief Find the aggregating slot of a region
+ *
+ * @return NULL if the region is not aggregated
+ */
+AiCameraAggregate *AiCamera::getAggregate(uint8_t region)
+{
+#if AGG_SLOT_COUNT > 0
+  for (uint8_t i = 0; i < aggCount; i++)
+  {
+    if (aggSlots[i].region == region)
+    {
+      return &aggSlots[i];
+    }
+  }
+#else
+  (void)region;
+#endif
+  return NULL;
+}
+
+/**
+ * @brief Fill the aggregated statistics of the regions due into sendDoc,
+ *        and start a new window for them
+ *
+ * @param dueMask regions to be sent, from getDueRegions()
+ */
+void AiCamera::packAggregates(uint32_t dueMask)
+{
+#if AGG_SLOT_COUNT > 0
+  // "A\0B\0..." so that every key is a static string
+  static const char keys[] = "A\0B\0C\0D\0E\0F\0G\0H\0I\0J\0K\0L\0M\0N\0O\0P\0Q\0R\0S\0T\0U\0V\0W\0X\0Y\0Z";
+  for (uint8_t i = 0; i < aggCount; i++)
+  {
+    AiCameraAggregate *slot = &aggSlots[i];
+    const char *key = keys + 2 * slot->region;
+    int32_t value;
+    if (!(dueMask & (1UL << slot->region)))
+    {
+      continue;
+    }
+    switch (slot->mode)
+    {
+    case AGG_MIN:
+      value = slot->count ? slot->min : slot->last;
+      break;
+    case AGG_MAX:
+      value = slot->count ? slot->max : slot->last;
+      break;
+    case AGG_MEAN:
+      value = slot->count ? slot->sum / slot->count : slot->last;
+      break;
+    case AGG_COUNT:
+      value = slot->count;
+      break;
+    default:
+      value = slot->last;
+      break;
+    }
+    if (slot->divider == 1)
+    {
+      sendDoc[key] = value;
+    }
+    else
+    {
+      sendDoc[key] = (double)value / slot->divider;
+    }
+    slot->count = 0;
+    slot->sum = 0;
+  }
+#else
+  (void)dueMask;
+#endif
+}
+
+/**
+ * @brief subtract part of the string
+ *
+ * @param str string pointer to be subtract
+ * @param start start position of content to be subtracted
+ * @param end end position of Content to be subtracted
+ */
+void AiCamera::subString(char *str, int16_t start, int16_t end)
+{
+  uint8_t length = strlen(str);
+  if (end == -1)
+  {
+    end = length;
+  }
+  for (uint8_t i = 0; i < end; i++)
+  {
+    if (i + start < end)
+    {
+      str[i] = str[i + start];
+    }
+    else
+    {
+      str[i] = '\0';
+    }
+  }
+}
+
+/**
+ * @brief Split the string by a cdivider,
+ *         and return characters of the selected index
  *
- * @param buffer  Pointer to the String value of the stored data
+ * @param str string pointer to be split
+ * @param index which index do you wish to return
+ * @param result char array pointer to hold the result
+ * @param divider
+ * @param size size of result, longer values are truncated
  */
-void AiCamera::readInto(char *buffer)
+void AiCamera::getStrOf(char *str, uint8_t index, char *result, char divider, uint8_t size)
 {
-  /* !!! attention buffer size*/
-  bool finished = false;
-  bool isBinary = false;
-  bool binaryDataStarted = false;
-  uint8_t binaryByteCount = 0;
-  uint8_t binaryDataLength = 0;
-  uint8_t binaryChecksum = 0;
-  uint8_t inchar;
-  uint32_t count = 0;
-  StrClear(buffer);
-
-  uint32_t char_time = millis();
+  uint8_t start, end;
+  uint8_t length = strlen(str);
+  uint8_t i, j;
 
-  // recv Byte
-  while (DataSerial.available())
+  // Get start index
+  if (index == 0)
   {
-    count += 1;
-    if (count > WS_BUFFER_SIZE)
-    {
-      finished = true;
-      break;
-    }
-    inchar = (uint8_t)DataSerial.read();
-    if (isBinary)
+    start = 0;
+  }
+  else
+  {
+    for (start = 0, j = 1; start < length; start++)
     {
-      // Start Byte
-      // DebugSerial.print(F("binaryDataStarted: "));DebugSerial.println(binaryDataStarted);
-      // DebugSerial.print(binaryByteCount);
-      // DebugSerial.print(F(": 0x"));DebugSerial.println(inchar, HEX);
-      if (!binaryDataStarted && binaryByteCount == 0)
-      {
-        if (inchar == BIN_START_BYTE)
-        {
-          // DebugSerial.println("binary start");
-          binaryDataStarted = true;
-          StrClear(buffer);
-          binaryByteCount = 1;
-          continue;
-        }
-        else
-        {
-          DebugSerial.print(F("binary start byte error: 0x"));
-          DebugSerial.println(inchar, HEX);
-          continue;
-        }
-      } // Length Byte
-      else if (binaryDataStarted && binaryByteCount == 1)
-      {
-        binaryDataLength = inchar;
-        // DebugSerial.print(F("data length: "));DebugSerial.println(binaryDataLength);
-      } // Checksum Byte
-      else if (binaryDataStarted && binaryByteCount == 2)
-      {
-        binaryChecksum = inchar;
-        // DebugSerial.print(F("checksum: "));DebugSerial.println(binaryChecksum);
-      } // End Byte
-      else if (binaryDataStarted && binaryByteCount == binaryDataLength + 3)
+      if (str[start] == divider)
       {
-        if (inchar != BIN_END_BYTE)
-        {
-          DebugSerial.println(F("end byte error"));
-          continue;
-        }
-        // DebugSerial.println(F("binary end byte"));
-        uint8_t checksum = buffer[0];
-        for (uint8_t i = 1; i < binaryDataLength; i++)
-        {
-          checksum ^= buffer[i];
-        }
-        if (checksum != binaryChecksum)
+        if (index == j)
         {
-          DebugSerial.print(F("checksum error, expect: "));
-          DebugSerial.print(checksum);
-          DebugSerial.print(", actual: ");
-          DebugSerial.println(binaryChecksum);
-          continue;
+          start++;
+          break;
         }
-        finished = true;
-        binaryDataStarted = false;
-        binaryByteCount = 0;
-        break;
-      } // Data Byte
-      else if (binaryDataStarted)
-      {
-        uint8_t index = binaryByteCount - 3;
-        // DebugSerial.print("index: ");DebugSerial.print(index);
-        // DebugSerial.print(", data: 0x");DebugSerial.println(inchar, HEX);
-        buffer[index] = inchar;
+        j++;
       }
-      binaryByteCount += 1;
     }
-    else
+  }
+  // Get end index
+  for (end = start, j = 0; end < length; end++)
+  {
+    if (str[end] == divider)
     {
-      if (inchar == '\n')
-      {
-        finished = true;
-        break;
-      }
-      else if (inchar == '\r')
-      {
-        continue;
-      }
-      else if ((int)inchar > 31 && (int)inchar < 127)
+      break;
+    }
+  }
+  // Copy result, '\0' takes up one byte
+  if (end - start >= size)
+  {
+    end = start + size - 1;
+  }
+
+  for (i = start, j = 0; i < end; i++, j++)
+  {
+    result[j] = str[i];
+  }
+  result[j] = '\0';
+}
+
+/**
+ * @brief split by divider, filling the value to a position in the string
+ *
+ * @param str string pointer to be operated
+ * @param index which index do you wish to return
+ * @param value the value to be filled
+ * @param divider
+ */
+void AiCamera::setStrOf(char *str, uint8_t index, String value, char divider)
+{
+  uint8_t start, end;
+  uint8_t length = strlen(str);
+  uint8_t i, j;
+  // Get start index
+  if (index == 0)
+  {
+    start = 0;
+  }
+  else
+  {
+    for (start = 0, j = 1; start < length; start++)
+    {
+      if (str[start] == divider)
       {
-        StrAppend(buffer, inchar);
-        if (IsStartWith(buffer, WS_BIN_HEADER))
+        if (index == j)
         {
-          // DebugSerial.println("binary data start");
-          isBinary = true;
+          start++;
+          break;
         }
-        delay(1); // Wait for StrAppend
+        j++;
       }
     }
   }
+  // Get end index
+  for (end = start, j = 0; end < length; end++)
+  {
+    if (str[end] == divider)
+    {
+      break;
+    }
+  }
+  String strString = str;
+  String strValue = strString.substring(0, start) + value + strString.substring(end);
+  strcpy(str, strValue.c_str());
+}
+
+/**
+ * @brief Split the string by a cdivider,
+ *         and return characters of the selected index.
+ *         Further, the content is converted to int type.
+ *
+ * @param buf string pointer to be split
+ * @param index which index do you wish to return
+ * @param divider
+ */
+int16_t AiCamera::getIntOf(char *str, uint8_t index, char divider)
+{
+  int16_t result;
+  char strResult[VALUE_SIZE];
+  getStrOf(str, index, strResult, divider, sizeof(strResult));
+  result = atoi(strResult);
+  return result;
+}
+
+bool AiCamera::getBoolOf(char *str, uint8_t index)
+{
+  char strResult[VALUE_SIZE];
+  getStrOf(str, index, strResult, ';', sizeof(strResult));
+  return atoi(strResult);
+}
+
+double AiCamera::getDoubleOf(char *str, uint8_t index)
+{
+  double result;
+  char strResult[VALUE_SIZE];
+  getStrOf(str, index, strResult, ';', sizeof(strResult));
+  result = atof(strResult);
+  return result;
+}
+
+void AiCamera::lamp_on(uint8_t level)
+{
+  lampLevel = level;
+  sendVideoSetting(VIDEO_SETTING_LAMP, level);
+}
+
+void AiCamera::lamp_off(void)
+{
+  lampLevel = 0;
+  sendVideoSetting(VIDEO_SETTING_LAMP, 0);
+}
+
+/**
+ * @brief Send a video stream setting to ESP32-CAM without waiting.
+ *        While the camera is re-configured after a reboot the setting is
+ *        only stored, it is replayed at the end of the re-configuration
+ *
+ * @param setting VIDEO_SETTING_FRAMESIZE, VIDEO_SETTING_QUALITY ...
+ * @param value setting value
+ */
+void AiCamera::sendVideoSetting(uint8_t setting, uint8_t value)
+{
+  char valueStr[4];
+  STATE_SET_BITS(videoSettings, 1 << setting);
+  if (provisionState != PROVISION_IDLE)
+  {
+    STATE_SET_BITS(provisionPending, 1 << setting);
+    return;
+  }
+  itoa(value, valueStr, 10);
+  this->sendCommand((const __FlashStringHelper *)videoCmds[setting], valueStr);
+}
+
+/**
+ * @brief Set the frame size of the video stream
+ *
+ * @param frameSize CAM_FRAMESIZE_QQVGA, CAM_FRAMESIZE_QVGA, CAM_FRAMESIZE_VGA ...
+ */
+void AiCamera::setFrameSize(uint8_t frameSize)
+{
+  videoFrameSize = frameSize;
+  adaptFrameSize = frameSize;
+  sendVideoSetting(VIDEO_SETTING_FRAMESIZE, frameSize);
+}
+
+/**
+ * @brief Set the JPEG quality of the video stream
+ *
+ * @param quality CAM_QUALITY_BEST (10) to CAM_QUALITY_WORST (63),
+ *                lower value means better image and more bandwidth
+ */
+void AiCamera::setQuality(uint8_t quality)
+{
+  videoQuality = constrain(quality, CAM_QUALITY_BEST, CAM_QUALITY_WORST);
+  adaptQuality = videoQuality;
+  sendVideoSetting(VIDEO_SETTING_QUALITY, videoQuality);
+}
+
+/**
+ * @brief Cap the frame rate of the video stream
+ *
+ * @param fps frames per second, 0 for no limit
+ */
+void AiCamera::setFrameRate(uint8_t fps)
+{
+  videoFrameRate = fps;
+  sendVideoSetting(VIDEO_SETTING_FPS, fps);
+}
+
+void AiCamera::stream_on(void)
+{
+  videoStream = 1;
+  sendVideoSetting(VIDEO_SETTING_STREAM, 1);
+}
+
+void AiCamera::stream_off(void)
+{
+  videoStream = 0;
+  sendVideoSetting(VIDEO_SETTING_STREAM, 0);
+}
+
+/**
+ * @brief Lower JPEG quality, then frame size, when congestion is reported
+ *        with reportCongestion(), and restore them step by step once the
+ *        link has been quiet for VIDEO_RECOVER_TIME. Does nothing without
+ *        VIDEO_ADAPTIVE, the default on AVR
+ *
+ * @param enable enable adaptive mode
+ * @param minFrameSize the smallest frame size to drop to
+ * @param maxQuality the worst JPEG quality to drop to
+ */
+void AiCamera::setVideoAdaptive(bool enable, uint8_t minFrameSize, uint8_t maxQuality)
+{
+#if VIDEO_ADAPTIVE
+  videoAdaptive = enable;
+  videoMinFrameSize = minFrameSize;
+  videoMaxQuality = constrain(maxQuality, CAM_QUALITY_BEST, CAM_QUALITY_WORST);
+  if (!(STATE_ACQUIRE(videoSettings) & (1 << VIDEO_SETTING_QUALITY)))
+  {
+    videoQuality = CAM_QUALITY_DEFAULT;
+    adaptQuality = CAM_QUALITY_DEFAULT;
+    STATE_SET_BITS(videoSettings, 1 << VIDEO_SETTING_QUALITY);
+  }
+#else
+  (void)enable;
+  (void)minFrameSize;
+  (void)maxQuality;
+#endif
+}
+
+/**
+ * @brief Report that the link is congested, e.g. when the app lags.
+ *        In adaptive mode it degrades the video stream by one step,
+ *        at most once every VIDEO_ADAPT_INTERVAL
+ */
+void AiCamera::reportCongestion(void)
+{
+#if VIDEO_ADAPTIVE
+  congestionTime = millis();
+  if (!videoAdaptive || millis() - adaptTime < VIDEO_ADAPT_INTERVAL)
+  {
+    return;
+  }
+  if (adaptQuality < videoMaxQuality)
+  {
+    adaptQuality = min(adaptQuality + VIDEO_QUALITY_STEP, (int)videoMaxQuality);
+    sendVideoSetting(VIDEO_SETTING_QUALITY, adaptQuality);
+  }
+  else if ((STATE_ACQUIRE(videoSettings) & (1 << VIDEO_SETTING_FRAMESIZE)) && adaptFrameSize > videoMinFrameSize)
+  {
+    adaptFrameSize--;
+    sendVideoSetting(VIDEO_SETTING_FRAMESIZE, adaptFrameSize);
+  }
+  adaptTime = millis();
+#endif
+}
+
+/**
+ * @brief Restore the video settings after congestion, called from loop()
+ */
+void AiCamera::videoLoop()
+{
+#if VIDEO_ADAPTIVE
+  if (!videoAdaptive || millis() - congestionTime < VIDEO_RECOVER_TIME || millis() - adaptTime < VIDEO_ADAPT_INTERVAL)
+  {
+    return;
+  }
+  // undo in reverse order: frame size first, then quality
+  if (adaptFrameSize != videoFrameSize)
+  {
+    adaptFrameSize++;
+    sendVideoSetting(VIDEO_SETTING_FRAMESIZE, adaptFrameSize);
+    adaptTime = millis();
+  }
+  else if (adaptQuality > videoQuality)
+  {
+    adaptQuality = max(adaptQuality - VIDEO_QUALITY_STEP, (int)videoQuality);
+    sendVideoSetting(VIDEO_SETTING_QUALITY, adaptQuality);
+    adaptTime = millis();
+  }
+#endif
+}
+
+/**
+ * @brief Get the frame size currently applied, including adaptive changes
+ */
+uint8_t AiCamera::getFrameSize()
+{
+  return adaptFrameSize;
+}
 
-  // if recv debug info
-  if (finished)
+/**
+ * @brief Get the JPEG quality currently applied, including adaptive changes
+ */
+uint8_t AiCamera::getQuality()
+{
+  return adaptQuality;
+}
+
+/**
+ * @brief Subscribe to vision results of some detectors only,
+ *        so ESP32-CAM does not send the others
+ *
+ * @param mask VISION_MASK(VISION_OBJECT) | VISION_MASK(VISION_LINE) ..., or VISION_ALL
+ */
+void AiCamera::subscribeVision(uint8_t mask)
+{
+  visionMask = mask;
+  sendVideoSetting(VIDEO_SETTING_VISION, mask);
+}
+
+/**
+ * @brief Check if the binary data received is a complete vision result
+ */
+bool AiCamera::isVision()
+{
+  const AiCameraVisionHeader *header = (const AiCameraVisionHeader *)recvBuffer;
+  if (recvBufferLength < sizeof(AiCameraVisionHeader) || header->msgType != BIN_TYPE_VISION)
   {
-    if (isBinary)
-    {
-      recvBufferType = WS_BUFFER_TYPE_BINARY;
-      recvBufferLength = binaryDataLength;
-    }
-    else
-    {
-      debug(buffer);
-      recvBufferType = WS_BUFFER_TYPE_TEXT;
-    }
-    if (IsStartWith(buffer, CAM_DEBUG_HEAD_DEBUG))
-    {
-#if (CAM_DEBUG_LEVEL == CAM_DEBUG_LEVEL_DEBUG) // all
-      DebugSerial.print(CAM_DEBUG_HEAD_DEBUG);
-      DebugSerial.println(buffer);
-#endif
-      StrClear(buffer);
-    }
+    return false;
   }
+  return recvBufferLength == sizeof(AiCameraVisionHeader) + header->count * sizeof(AiCameraDetection);
 }
 
 /**
- * @brief Serial port sends data, automatically adds header (WS_HEADER)
+ * @brief Get the header of the vision result received,
+ *        points into recvBuffer and is valid until the next loop()
+ *
+ * @code {.cpp}
+ * void onVision() {
+ *   const AiCameraVisionHeader *vision = aiCam.getVision();
+ *   const AiCameraDetection *detections = aiCam.getDetections();
+ *   for (uint8_t i = 0; i < vision->count; i++) {
+ *     if (detections[i].type == VISION_LINE) {
+ *       steer(detections[i].x);
+ *     }
+ *   }
+ * }
+ * @endcode
  */
-void AiCamera::sendData()
+const AiCameraVisionHeader *AiCamera::getVision()
 {
-  DataSerial.print(F(WS_HEADER));
-  // sendDoc["A"] = 0;
-  serializeJson(sendDoc, DataSerial);
-  DataSerial.print("\n");
+  return (const AiCameraVisionHeader *)recvBuffer;
 }
 
 /**
- * @brief Send binary data
- *
- * @param data binary data
- * @param len data length
+ * @brief Get the detection records of the vision result received,
+ *        getVision()->count records, valid until the next loop()
  */
-void AiCamera::sendBinaryData(uint8_t *data, size_t len)
+const AiCameraDetection *AiCamera::getDetections()
 {
-  DataSerial.print(F(WS_BIN_HEADER));
-  DataSerial.write(data, len);
-  DataSerial.print("\n");
+  return (const AiCameraDetection *)(recvBuffer + sizeof(AiCameraVisionHeader));
 }
 
 /**
- * @brief Set command timeout
+ * @brief Start sending a large payload in chunks, pumped by loop().
+ *        At most BULK_WINDOW chunks wait for the ESP32-CAM ack, chunks
+ *        not acked within BULK_TIMEOUT are sent again
  *
- * @param _timeout timeout value
+ * @param length payload length in bytes
+ * @param producer callback filling `buffer` with up to `size` bytes from `offset`,
+ *                 returns the bytes filled. The same offset may be asked again
+ *                 for a retransmission, so only data up to BULK_WINDOW chunks
+ *                 behind the newest one needs to be kept. Filling fewer bytes
+ *                 than `size` fails the transfer
+ * @return false if a transfer is already running, or length needs more
+ *         than 65535 chunks, always on AVR unless BULK_TRANSFER is set
+ *
+ * @code {.cpp}
+ * size_t readSweep(uint32_t offset, uint8_t *buffer, size_t size) {
+ *   memcpy(buffer, (uint8_t *)sweep + offset, size);
+ *   return size;
+ * }
+ * aiCam.sendBulk(sizeof(sweep), readSweep);
+ * @endcode
  */
-void AiCamera::setCommandTimeout(uint32_t _timeout)
+bool AiCamera::sendBulk(uint32_t length, size_t (*producer)(uint32_t offset, uint8_t *buffer, size_t size))
 {
-  cmdTimeout = _timeout;
+#if BULK_TRANSFER
+  if (STATE_ACQUIRE(bulkState) == BULK_BUSY || length > 0xFFFFUL * BULK_CHUNK_SIZE)
+  {
+    return false;
+  }
+  __bulkProducer__ = producer;
+  bulkId++;
+  bulkRetry = 0;
+  bulkLength = length;
+  bulkChunks = (length + BULK_CHUNK_SIZE - 1) / BULK_CHUNK_SIZE;
+  bulkBase = 0;
+  bulkNext = 0;
+  bulkStartTime = millis();
+  bulkTime = bulkStartTime;
+  bulkThroughput = 0;
+  bulkReadyTime = micros();
+  // the first chunk does not wait for pacing
+  bulkTxTime = bulkReadyTime - BULK_FRAME_LENGTH * 1000000UL / BULK_LINE_RATE;
+  // the pump task only starts once everything above is set
+  STATE_PUBLISH(bulkState, bulkChunks == 0 ? BULK_DONE : BULK_BUSY);
+  this->wakePump();
+  return true;
+#else
+  (void)length;
+  (void)producer;
+  return false;
+#endif
 }
 
+#if BULK_TRANSFER
 /**
- * @brief Send command to ESP32-CAM with serial
+ * @brief Pull one chunk from the producer and send it
  *
- * @param command command keyword
- * @param value
- * @param result returned information from serial
+ * @param seq chunk sequence
+ * @return false if the producer filled less than the chunk, nothing is sent
  */
-void AiCamera::command(const char *command, const char *value, char *result, bool wait)
+bool AiCamera::bulkSendChunk(uint16_t seq)
 {
-  bool is_ok = false;
-  uint8_t retry_count = 0;
-  uint8_t retryMaxCount = 3;
+  uint8_t header[BULK_HEADER_LENGTH] = {
+      BIN_TYPE_BULK, bulkId,
+      (uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8),
+      (uint8_t)(bulkChunks & 0xFF), (uint8_t)(bulkChunks >> 8)};
+  uint8_t chunk[BULK_CHUNK_SIZE];
+  uint32_t offset = (uint32_t)seq * BULK_CHUNK_SIZE;
+  size_t size = min((uint32_t)BULK_CHUNK_SIZE, bulkLength - offset);
 
-  while (retry_count < retryMaxCount)
+  if (__bulkProducer__(offset, chunk, size) < size)
   {
-    DataSerial.flush();
-    DataSerial.print(F("SET+"));
-    DataSerial.print(command);
-    DataSerial.println(value);
-    DataSerial.print(F("..."));
-    if (!wait)
-      return; // if not waiting, return immediately
-
-    retry_count++;
+    // the chunk boundaries are fixed, a short chunk can not be sent
+    return false;
+  }
+  DataSerial.clearWriteError();
+  DataSerial.print(F(WS_BIN_HEADER));
+  DataSerial.write(header, BULK_HEADER_LENGTH);
+  DataSerial.write(chunk, size);
+  DataSerial.print("\n");
+  // a cut chunk is not acknowledged, and sent again on BULK_TIMEOUT
+  if (!this->txFailed())
+  {
+    txDone(TX_LANE_BULK, bulkReadyTime);
+  }
+  bulkTxTime = micros();
+  return true;
+}
+#endif
 
-    uint32_t st = millis();
-    while ((millis() - st) < cmdTimeout)
+/**
+ * @brief Send the next chunk the window allows and retransmit on timeout,
+ *        called from loop(). Only one chunk is written per call, and not
+ *        before the previous one left the TX buffer at BULK_LINE_RATE,
+ *        so urgent frames never wait for more than one chunk
+ */
+void AiCamera::bulkLoop()
+{
+#if BULK_TRANSFER
+  if (STATE_ACQUIRE(bulkState) != BULK_BUSY)
+  {
+    return;
+  }
+  if (provisionState != PROVISION_IDLE)
+  {
+    // camera is rebooting, do not count it as a timeout
+    bulkTime = millis();
+    return;
+  }
+  if (millis() - bulkTime >= BULK_TIMEOUT)
+  {
+    if (++bulkRetry > BULK_RETRY_COUNT)
     {
-      this->readInto(recvBuffer);
-      // if (recvBuffer[0] == 0) continue;
-      // DebugSerial.println(recvBuffer);
-      if (IsStartWith(recvBuffer, OK_FLAG))
-      {
-        is_ok = true;
-        DataSerial.println(F(OK_FLAG));
-        this->subString(recvBuffer, strlen(OK_FLAG) + 1); // Add 1 for Space
-        // !!! Note that the reslut size here is too small and may be out of bounds,
-        // causing unexpected data changes
-        strcpy(result, recvBuffer);
-        break;
-      }
+      STATE_PUBLISH(bulkState, BULK_FAILED);
+      return;
     }
-
-    if (is_ok == true)
+    // go back to the oldest chunk not acked
+    bulkNext = bulkBase;
+    bulkTime = millis();
+    bulkReadyTime = micros();
+  }
+  if (bulkNext < bulkChunks && bulkNext - bulkBase < BULK_WINDOW &&
+      micros() - bulkTxTime >= BULK_FRAME_LENGTH * 1000000UL / BULK_LINE_RATE)
+  {
+    if (!this->bulkSendChunk(bulkNext))
     {
-      break;
+      STATE_PUBLISH(bulkState, BULK_FAILED);
+      return;
     }
+    bulkNext++;
+    bulkTime = millis();
+    bulkReadyTime = bulkTxTime;
   }
+#endif
+}
 
-  if (is_ok == false)
+/**
+ * @brief Handle an ack from ESP32-CAM, slides the window forward
+ */
+void AiCamera::bulkAck()
+{
+#if BULK_TRANSFER
+  uint16_t ack = recvBuffer[2] | (recvBuffer[3] << 8);
+  if (STATE_ACQUIRE(bulkState) != BULK_BUSY || recvBuffer[1] != bulkId || ack <= bulkBase || ack > bulkNext)
   {
-    Serial.println(F("[FAIL]"));
-    while (1)
-      ;
+    return;
   }
-  DataSerial.flush();
+  if (bulkNext - bulkBase >= BULK_WINDOW)
+  {
+    // window was full, the next chunk is ready from now on
+    bulkReadyTime = micros();
+  }
+  bulkBase = ack;
+  bulkRetry = 0;
+  bulkTime = millis();
+  uint32_t elapsed = max(millis() - bulkStartTime, 1UL);
+  bulkThroughput = min((uint32_t)bulkBase * BULK_CHUNK_SIZE, bulkLength) * 1000UL / elapsed;
+  if (bulkBase == bulkChunks)
+  {
+    STATE_PUBLISH(bulkState, BULK_DONE);
+  }
+#endif
 }
 
 /**
- * @brief Use the comand() function to set up the ESP32-CAM
- *
- * @param command command keyword
+ * @brief State of the last bulk transfer:
+ *        BULK_IDLE, BULK_BUSY, BULK_DONE or BULK_FAILED
  */
-void AiCamera::set(const char *command, bool wait)
+uint8_t AiCamera::getBulkState()
 {
-  char result[10];
-  this->command(command, "", result, wait);
+#if BULK_TRANSFER
+  return STATE_ACQUIRE(bulkState);
+#else
+  return BULK_IDLE;
+#endif
 }
 
 /**
- * @brief Use the comand() function to set up the ESP32-CAM
+ * @brief Acked bytes per second of the current or last bulk transfer
+ */
+uint32_t AiCamera::getBulkThroughput()
+{
+#if BULK_TRANSFER
+  return bulkThroughput;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Bulk throughput in percent of the line rate (BULK_LINE_RATE)
+ */
+uint8_t AiCamera::getBulkEfficiency()
+{
+#if BULK_TRANSFER
+  return bulkThroughput * 100UL / BULK_LINE_RATE;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Ask ESP32-CAM for one JPEG frame, streamed in chunks into `sink`
+ *        while loop() runs, so the image never has to fit in RAM.
+ *        Each chunk is acked, ESP32-CAM sends the next one after the ack
  *
- * @param command command keyword
- * @param value
+ * @param frameSize CAM_FRAMESIZE_QVGA, CAM_FRAMESIZE_VGA ...
+ * @param quality JPEG quality, CAM_QUALITY_BEST (10) to CAM_QUALITY_WORST (63)
+ * @param sink callback receiving the JPEG bytes at `offset` in order,
+ *             return false to cancel the snapshot
+ * @return false if a snapshot is already running or the camera is
+ *         being re-configured after a reboot, always on AVR unless
+ *         SNAPSHOT_TRANSFER is set
  *
  * @code {.cpp}
- * set("NAME", "Zeus_Car");
- * set("TYPE", "Zeus_Car");
- * set("SSID", "Zeus_Car");
- * set("PSK",  "12345678");
- * set("MODE", WIFI_MODE_AP);
- * set("PORT", "8765");
+ * File file;
+ * bool writeJpeg(uint32_t offset, const uint8_t *data, size_t size) {
+ *   return file.write(data, size) == size;
+ * }
+ * file = SD.open("event.jpg", FILE_WRITE);
+ * aiCam.takeSnapshot(CAM_FRAMESIZE_VGA, 12, writeJpeg);
  * @endcode
- *
  */
-void AiCamera::set(const char *command, const char *value, bool wait)
+bool AiCamera::takeSnapshot(uint8_t frameSize, uint8_t quality, bool (*sink)(uint32_t offset, const uint8_t *data, size_t size))
 {
-  char result[10];
-  this->command(command, value, result, wait);
+#if SNAPSHOT_TRANSFER
+  char value[16];
+  char *p = value;
+  if (STATE_ACQUIRE(snapState) == SNAPSHOT_BUSY || provisionState != PROVISION_IDLE)
+  {
+    return false;
+  }
+  __snapshotSink__ = sink;
+  snapId++;
+  snapRetry = 0;
+  snapSeq = 0;
+  snapSize = 0;
+  snapReceived = 0;
+  snapStartTime = millis();
+  snapTime = snapStartTime;
+  // the pump task only takes chunks once everything above is set
+  STATE_PUBLISH(snapState, SNAPSHOT_BUSY);
+  // id,frame size,quality,largest chunk the receive buffer takes
+  uint16_t fields[] = {snapId, frameSize, quality, SNAPSHOT_CHUNK_SIZE};
+  for (uint8_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+  {
+    if (i > 0)
+    {
+      *p++ = ',';
+    }
+    utoa(fields[i], p, 10);
+    p += strlen(p);
+  }
+  this->sendCommand(F("SNAP"), value);
+  return true;
+#else
+  (void)frameSize;
+  (void)quality;
+  (void)sink;
+  return false;
+#endif
 }
 
 /**
- * @brief Use the comand() function to set up the ESP32-CAM,
- *        and receive return information
- *
- * @param command command keyword
- * @param value
- * @param result returned information from serial
- * @code {.cpp}
- * char ip[15];
- * get("START", ip);
- * @endcode
+ * @brief Handle a snapshot chunk from ESP32-CAM, runs in the pump
  */
-void AiCamera::get(const char *command, char *result)
+void AiCamera::snapshotChunk()
 {
-  this->command(command, "", result);
+#if SNAPSHOT_TRANSFER
+  uint16_t seq = recvBuffer[2] | (recvBuffer[3] << 8);
+  uint8_t *data = recvBuffer + SNAPSHOT_HEADER_LENGTH;
+  size_t size = recvBufferLength - SNAPSHOT_HEADER_LENGTH;
+  if (STATE_ACQUIRE(snapState) != SNAPSHOT_BUSY || recvBuffer[1] != snapId)
+  {
+    return;
+  }
+  snapTime = millis();
+  if (seq != snapSeq)
+  {
+    // lost or repeated chunk, ask again for the one expected
+    this->snapshotAck(snapSeq);
+    return;
+  }
+  snapSize = (uint32_t)recvBuffer[4] | ((uint32_t)recvBuffer[5] << 8) |
+             ((uint32_t)recvBuffer[6] << 16) | ((uint32_t)recvBuffer[7] << 24);
+  if (!__snapshotSink__(snapReceived, data, size))
+  {
+    this->snapshotAck(SNAPSHOT_CANCEL);
+    STATE_PUBLISH(snapState, SNAPSHOT_FAILED);
+    return;
+  }
+  snapReceived += size;
+  snapSeq++;
+  snapRetry = 0;
+  this->snapshotAck(snapSeq);
+  if (snapReceived >= snapSize)
+  {
+    STATE_PUBLISH(snapState, SNAPSHOT_DONE);
+  }
+#endif
 }
 
+#if SNAPSHOT_TRANSFER
 /**
- * @brief Use the comand() function to set up the ESP32-CAM,
- *        and receive return information
+ * @brief Ack snapshot chunks up to `seq`, written from the pump directly
  *
- * @param command command keyword
- * @param value
- * @param result returned information from serial
+ * @param seq next expected sequence, or SNAPSHOT_CANCEL
  */
-void AiCamera::get(const char *command, const char *value, char *result)
+void AiCamera::snapshotAck(uint16_t seq)
 {
-  this->command(command, value, result);
+  uint8_t ack[4] = {BIN_TYPE_SNAPSHOT_ACK, snapId, (uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8)};
+  DataSerial.print(F(WS_BIN_HEADER));
+  DataSerial.write(ack, sizeof(ack));
+  DataSerial.print("\n");
 }
+#endif
 
 /**
- * @brief Interpret the value of the slider contorl component from the buf string
- *
- * @param buf string pointer to be interpreted
- * @param region the key of component
- * @return the value of the slider contorl component
+ * @brief Ask again for the expected chunk when none arrives in time,
+ *        called from loop()
  */
-int16_t AiCamera::getSlider(uint8_t region)
+void AiCamera::snapshotLoop()
 {
-  int16_t value = getIntOf(recvBuffer, region);
-  return value;
+#if SNAPSHOT_TRANSFER
+  if (STATE_ACQUIRE(snapState) != SNAPSHOT_BUSY || millis() - snapTime < SNAPSHOT_TIMEOUT)
+  {
+    return;
+  }
+  if (++snapRetry > SNAPSHOT_RETRY_COUNT)
+  {
+    STATE_PUBLISH(snapState, SNAPSHOT_FAILED);
+    return;
+  }
+  this->snapshotAck(snapSeq);
+  snapTime = millis();
+#endif
 }
 
 /**
- * @brief Interpret the value of the Button component from the buf string
- *
- * @param buf string pointer to be interpreted
- * @param region the key of component
- * @return the value of the Joystick component
- *        - true
- *        - flase
+ * @brief State of the last snapshot:
+ *        SNAPSHOT_IDLE, SNAPSHOT_BUSY, SNAPSHOT_DONE or SNAPSHOT_FAILED
  */
-bool AiCamera::getButton(uint8_t region)
+uint8_t AiCamera::getSnapshotState()
 {
-  bool value = getBoolOf(recvBuffer, region);
-  return value;
+#if SNAPSHOT_TRANSFER
+  return STATE_ACQUIRE(snapState);
+#else
+  return SNAPSHOT_IDLE;
+#endif
 }
 
 /**
- * @brief Interpret the value of the getSwitch component from the buf string
- *
- * @param buf string pointer to be interpreted
- * @param region the key of component
- * @return the value of the Joystick component
- *        - true
- *        - flase
+ * @brief JPEG size of the last snapshot in bytes, known from the first chunk
  */
-bool AiCamera::getSwitch(uint8_t region)
+uint32_t AiCamera::getSnapshotSize()
 {
-  bool value = getBoolOf(recvBuffer, region);
-  return value;
+#if SNAPSHOT_TRANSFER
+  return snapSize;
+#else
+  return 0;
+#endif
 }
 
 /**
- * @brief Interpret the value of the Joystick component from the buf string
- *
- * @param buf string pointer to be interpreted
- * @param region the key of component
- * @param axis which type of value that you want,
- *             could be JOYSTICK_X, JOYSTICK_Y, JOYSTICK_ANGLE, JOYSTICK_RADIUS
- * @return the value of the Joystick component
+ * @brief Throughput of the current or last snapshot in KB/s
  */
-int16_t AiCamera::getJoystick(uint8_t region, uint8_t axis)
+float AiCamera::getSnapshotThroughput()
 {
-  char valueStr[20];
-  int16_t x, y, angle, radius;
-  getStrOf(recvBuffer, region, valueStr, ';');
-  x = getIntOf(valueStr, 0, ',');
-  y = getIntOf(valueStr, 1, ',');
-  angle = atan2(x, y) * 180.0 / PI;
-  radius = sqrt(y * y + x * x);
-  switch (axis)
+#if SNAPSHOT_TRANSFER
+  uint32_t elapsed = snapTime - snapStartTime;
+  if (elapsed == 0)
   {
-  case JOYSTICK_X:
-    return x;
-  case JOYSTICK_Y:
-    return y;
-  case JOYSTICK_ANGLE:
-    return angle;
-  case JOYSTICK_RADIUS:
-    return radius;
-  default:
-    return 0;
+    elapsed = 1;
+  }
+  return snapReceived * 1000.0 / 1024.0 / elapsed;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Add a tunable parameter, synced with the app instead of being
+ *        sent in every control frame. Values from the app are clamped to
+ *        [min, max]. In task mode they are written in loop(), on the
+ *        app side, like the sketch does
+ *
+ * @param id key of the parameter in the records, unique
+ * @param name label shown by the app, up to PARAM_NAME_SIZE - 1 characters
+ * @param value storage of the sketch
+ * @return false if the id is used or PARAM_SLOT_COUNT parameters are added,
+ *         always on AVR unless PARAM_SLOT_COUNT is set
+ *
+ * @code {.cpp}
+ * float kp = 1.2;
+ * int16_t maxSpeed = 80;
+ * aiCam.addParam(0, "Kp", &kp, 0, 10);
+ * aiCam.addParam(1, "Max speed", &maxSpeed, 0, 100);
+ * aiCam.setParamStorage(0);
+ * @endcode
+ */
+bool AiCamera::addParam(uint8_t id, const char *name, int16_t *value, int16_t min, int16_t max)
+{
+  return this->paramAdd(id, name, value, PARAM_INT16, min, max);
+}
+
+bool AiCamera::addParam(uint8_t id, const char *name, int32_t *value, int32_t min, int32_t max)
+{
+  return this->paramAdd(id, name, value, PARAM_INT32, min, max);
+}
+
+bool AiCamera::addParam(uint8_t id, const char *name, float *value, float min, float max)
+{
+  int32_t minBits, maxBits;
+  memcpy(&minBits, &min, sizeof(minBits));
+  memcpy(&maxBits, &max, sizeof(maxBits));
+  return this->paramAdd(id, name, value, PARAM_FLOAT, minBits, maxBits);
+}
+
+bool AiCamera::addParam(uint8_t id, const char *name, bool *value)
+{
+  return this->paramAdd(id, name, value, PARAM_BOOL, 0, 1);
+}
+
+bool AiCamera::paramAdd(uint8_t id, const char *name, void *value, uint8_t type, int32_t min, int32_t max)
+{
+#if PARAM_SLOT_COUNT > 0
+  if (paramCount >= PARAM_SLOT_COUNT || getParam(id) != NULL)
+  {
+    return false;
   }
+  AiCameraParam *param = &params[paramCount++];
+  param->id = id;
+  param->type = type;
+  param->name = name;
+  param->value = value;
+  param->min = min;
+  param->max = max;
+  this->paramTouch(param);
+  return true;
+#else
+  (void)id;
+  (void)name;
+  (void)value;
+  (void)type;
+  (void)min;
+  (void)max;
+  return false;
+#endif
 }
 
 /**
- * @brief Interpret the value of the DPad component from the buf string
- *
- * @param buf string pointer to be interpreted
- * @param region the key of component
+ * @brief Tell the library the sketch changed a parameter, it is sent to
+ *        the app and saved to EEPROM if setParamStorage() is used
  *
- * @return the value of the DPadDPad component,
- *         it could be null, "forward", "backward", "left", "stop"
+ * @param id key of the parameter
  */
-uint8_t AiCamera::getDPad(uint8_t region)
+void AiCamera::paramChanged(uint8_t id)
 {
-  char value[20];
-  getStrOf(recvBuffer, region, value, ';');
-  uint8_t result;
-  if ((String)value == (String) "forward")
-    result = DPAD_FORWARD;
-  else if ((String)value == (String) "backward")
-    result = DPAD_BACKWARD;
-  else if ((String)value == (String) "left")
-    result = DPAD_LEFT;
-  else if ((String)value == (String) "right")
-    result = DPAD_RIGHT;
-  else if ((String)value == (String) "stop")
-    result = DPAD_STOP;
-  return result;
+  AiCameraParam *param = getParam(id);
+  if (param == NULL)
+  {
+    return;
+  }
+  this->paramTouch(param);
+  if (paramAddress >= 0)
+  {
+    paramSaveTime = millis();
+    paramSavePending = true;
+  }
 }
 
 /**
- * @brief Interpret the value of the Throttle component from the buf string
- *
- * @param buf string pointer to be interpreted
- * @param region the key of component
- *
- * @return the value of the Throttle component,
+ * @brief Version of the parameter table, incremented on every change
  */
-int16_t AiCamera::getThrottle(uint8_t region)
+uint16_t AiCamera::getParamVersion()
 {
-  int16_t value = getIntOf(recvBuffer, region);
-  return value;
+  return paramVersion;
 }
 
 /**
- * @brief Interpret the value of the Speech component from the buf string
+ * @brief Set callback function method for a parameter changed by the app,
+ *        called after the new value is stored
  *
- * @param buf string pointer to be interpreted
- * @param region the key of component
- * @param result char array pointer to hold the result
- * @return the value of the Joystick component
+ * @param func  callback function pointer
+ */
+void AiCamera::setOnParam(void (*func)(uint8_t id)) { __onParam__ = func; }
+
+/**
+ * @brief Keep the parameters in EEPROM: restore the saved values now, and
+ *        save them PARAM_SAVE_DELAY ms after the last change.
+ *        Call it after addParam(), it uses PARAM_EEPROM_SIZE bytes
+ *
+ * @param address first EEPROM byte used, -1 to stop saving
+ * @return true if saved values were restored, always false without
+ *         EEPROM.h (AI_CAM_EEPROM not defined)
  */
-void AiCamera::getSpeech(uint8_t region, char *result)
+bool AiCamera::setParamStorage(int address)
 {
-  getStrOf(recvBuffer, region, result, ';');
+#ifdef AI_CAM_EEPROM
+  paramAddress = address;
+  if (address < 0)
+  {
+    paramSavePending = false;
+    return false;
+  }
+  return this->paramLoad();
+#else
+  (void)address;
+  // where the debug port is the camera link (UNO), ESP32-CAM would get the hint
+  if ((void *)&DebugSerial != (void *)&DataSerial)
+  {
+    DebugSerial.println(F("No EEPROM.h, #include <EEPROM.h> in the sketch to save parameters"));
+  }
+  return false;
+#endif
 }
 
 /**
- * @brief Fill the value of Meter display component into the buf to be sent
+ * @brief Find a parameter by id
  *
- * @param region the key of component
- * @param value the value to be filled
+ * @return NULL if there is no such parameter
  */
-void AiCamera::setMeter(uint8_t region, double value)
+AiCameraParam *AiCamera::getParam(uint8_t id)
 {
-  setStrOf(recvBuffer, region, String(value));
+#if PARAM_SLOT_COUNT > 0
+  for (uint8_t i = 0; i < paramCount; i++)
+  {
+    if (params[i].id == id)
+    {
+      return &params[i];
+    }
+  }
+#else
+  (void)id;
+#endif
+  return NULL;
 }
 
 /**
- * @brief Fill the value of Radar display component into the buf to be sent
- *
- * @param region the key of component
- * @param angle the orientation of the obstacle
- * @param distance the distance of the obstacle
+ * @brief Value of a parameter as the int32 of a record, float as its bits
  */
-void AiCamera::setRadar(uint8_t region, int16_t angle, double distance)
+int32_t AiCamera::paramGet(AiCameraParam *param)
 {
-  setStrOf(recvBuffer, region, String(angle) + "," + String(distance));
+  int32_t raw = 0;
+  switch (param->type)
+  {
+  case PARAM_INT16:
+    raw = *(int16_t *)param->value;
+    break;
+  case PARAM_INT32:
+    raw = *(int32_t *)param->value;
+    break;
+  case PARAM_FLOAT:
+    memcpy(&raw, param->value, sizeof(raw));
+    break;
+  case PARAM_BOOL:
+    raw = *(bool *)param->value;
+    break;
+  }
+  return raw;
 }
 
 /**
- * @brief Fill the value of 3-way grayscale display component into the buf to be sent
+ * @brief Store the value of a record, clamped to the parameter range
  *
- * @param region the key of component
- * @param value1
- * @param value2
- * @param value3
+ * @return true if the stored value changed
  */
-void AiCamera::setGreyscale(uint8_t region, uint16_t value1, uint16_t value2, uint16_t value3)
+bool AiCamera::paramSet(AiCameraParam *param, int32_t raw)
 {
-  setStrOf(recvBuffer, region, String(value1) + "," + String(value2) + "," + String(value3));
+  if (param->type == PARAM_FLOAT)
+  {
+    float value;
+    memcpy(&value, &raw, sizeof(value));
+    float min, max;
+    memcpy(&min, &param->min, sizeof(min));
+    memcpy(&max, &param->max, sizeof(max));
+    if (value != value)
+    {
+      return false; // NaN
+    }
+    value = constrain(value, min, max);
+    if (*(float *)param->value == value)
+    {
+      return false;
+    }
+    *(float *)param->value = value;
+    return true;
+  }
+
+  if (raw < param->min)
+  {
+    raw = param->min;
+  }
+  else if (raw > param->max)
+  {
+    raw = param->max;
+  }
+  if (paramGet(param) == raw)
+  {
+    return false;
+  }
+  switch (param->type)
+  {
+  case PARAM_INT16:
+    *(int16_t *)param->value = (int16_t)raw;
+    break;
+  case PARAM_INT32:
+    *(int32_t *)param->value = raw;
+    break;
+  case PARAM_BOOL:
+    *(bool *)param->value = raw != 0;
+    break;
+  }
+  return true;
 }
 
-void AiCamera::setValue(uint8_t region, double value)
+/**
+ * @brief Give a parameter the next table version and queue it for the app
+ *
+ * @return the new version
+ */
+uint16_t AiCamera::paramTouch(AiCameraParam *param)
 {
-  setStrOf(recvBuffer, region, String(value));
+  uint16_t version = ++paramVersion;
+  param->version = version;
+  param->dirty = true;
+  paramDirty = true;
+  return version;
 }
 
 /**
- * @brief subtract part of the string
+ * @brief Handle a parameter message from the app: describe the table for
+ *        BIN_TYPE_PARAM_INFO, else apply the records and queue every
+ *        parameter changed since the version the app has. Values from the
+ *        app are always echoed, so the app sees where they were clamped.
+ *        In task mode the pump task hands the message to loop()
  *
- * @param str string pointer to be subtract
- * @param start start position of content to be subtracted
- * @param end end position of Content to be subtracted
+ * @param data message, starting with its type byte
+ * @param length message length
  */
-void AiCamera::subString(char *str, int16_t start, int16_t end)
+void AiCamera::paramReceive(const uint8_t *data, uint8_t length)
 {
-  uint8_t length = strlen(str);
-  if (end == -1)
+#if defined(AI_CAM_TASK) && PARAM_SLOT_COUNT > 0
+  if (taskMode && this->inPump())
   {
-    end = length;
+    paramQueue.begin();
+    paramQueue.write(data, length);
+    paramQueue.commit();
+    return;
   }
-  for (uint8_t i = 0; i < end; i++)
+#endif
+  if (data[0] == BIN_TYPE_PARAM_INFO)
   {
-    if (i + start < end)
+    this->paramSendInfo();
+    return;
+  }
+  uint16_t since = data[1] | ((uint16_t)data[2] << 8);
+  bool changed = false;
+  for (uint8_t i = PARAM_HEADER_LENGTH; i + PARAM_RECORD_LENGTH <= length; i += PARAM_RECORD_LENGTH)
+  {
+    AiCameraParam *param = getParam(data[i]);
+    if (param == NULL || param->type != data[i + 1])
     {
-      str[i] = str[i + start];
+      continue;
+    }
+    int32_t raw = (uint32_t)data[i + 2] | ((uint32_t)data[i + 3] << 8) |
+                  ((uint32_t)data[i + 4] << 16) | ((uint32_t)data[i + 5] << 24);
+    if (this->paramSet(param, raw))
+    {
+      this->paramTouch(param);
+      changed = true;
+      if (__onParam__ != NULL)
+      {
+        __onParam__(param->id);
+      }
     }
     else
     {
-      str[i] = '\0';
+      param->dirty = true;
+      paramDirty = true;
+    }
+  }
+#if PARAM_SLOT_COUNT > 0
+  for (uint8_t i = 0; i < paramCount; i++)
+  {
+    // 0 asks for the whole table, e.g. when the app connects
+    if (since == 0 || (int16_t)(params[i].version - since) > 0)
+    {
+      params[i].dirty = true;
+      paramDirty = true;
     }
   }
+#else
+  (void)since;
+#endif
+  if (changed && paramAddress >= 0)
+  {
+    paramSaveTime = millis();
+    paramSavePending = true;
+  }
 }
 
 /**
- * @brief Split the string by a cdivider,
- *         and return characters of the selected index
- *
- * @param str string pointer to be split
- * @param index which index do you wish to return
- * @param result char array pointer to hold the result
- * @param divider
+ * @brief Describe every parameter to the app, one message each
  */
-void AiCamera::getStrOf(char *str, uint8_t index, char *result, char divider)
+void AiCamera::paramSendInfo()
 {
-  uint8_t start, end;
-  uint8_t length = strlen(str);
-  uint8_t i, j;
+#if PARAM_SLOT_COUNT > 0
+  uint8_t info[PARAM_INFO_LENGTH + PARAM_NAME_SIZE - 1];
+  for (uint8_t i = 0; i < paramCount; i++)
+  {
+    AiCameraParam *param = &params[i];
+    size_t nameLength = strlen(param->name);
+    if (nameLength > PARAM_NAME_SIZE - 1)
+    {
+      nameLength = PARAM_NAME_SIZE - 1;
+    }
+    info[0] = BIN_TYPE_PARAM_INFO;
+    info[1] = param->id;
+    info[2] = param->type;
+    memcpy(info + 3, &param->min, 4);
+    memcpy(info + 7, &param->max, 4);
+    memcpy(info + PARAM_INFO_LENGTH, param->name, nameLength);
+    this->sendBinaryData(info, PARAM_INFO_LENGTH + nameLength);
+  }
+#endif
+}
 
-  // Get start index
-  if (index == 0)
+/**
+ * @brief Send the queued parameters to the app, and save them to EEPROM
+ *        once changes settle, called from pump(), or from loop() in task mode
+ */
+void AiCamera::paramLoop()
+{
+#if PARAM_SLOT_COUNT > 0
+  if (paramSavePending && millis() - paramSaveTime >= PARAM_SAVE_DELAY)
   {
-    start = 0;
+    this->paramSave();
   }
-  else
+  if (!paramDirty || !ws_connected)
   {
-    for (start = 0, j = 1; start < length; start++)
-    {
-      if (str[start] == divider)
-      {
-        if (index == j)
-        {
-          start++;
-          break;
-        }
-        j++;
-      }
-    }
+    return;
   }
-  // Get end index
-  for (end = start, j = 0; end < length; end++)
+  paramDirty = false;
+
+  uint8_t frame[PARAM_HEADER_LENGTH + PARAM_FRAME_RECORDS * PARAM_RECORD_LENGTH];
+  uint8_t length = PARAM_HEADER_LENGTH;
+  frame[0] = BIN_TYPE_PARAM;
+  frame[1] = (uint8_t)paramVersion;
+  frame[2] = (uint8_t)(paramVersion >> 8);
+  for (uint8_t i = 0; i <= paramCount; i++)
   {
-    if (str[end] == divider)
+    if (i < paramCount && params[i].dirty)
     {
-      break;
+      params[i].dirty = false;
+      int32_t raw = this->paramGet(&params[i]);
+      frame[length++] = params[i].id;
+      frame[length++] = params[i].type;
+      frame[length++] = (uint8_t)raw;
+      frame[length++] = (uint8_t)(raw >> 8);
+      frame[length++] = (uint8_t)(raw >> 16);
+      frame[length++] = (uint8_t)(raw >> 24);
+    }
+    if (length == sizeof(frame) || (i == paramCount && length > PARAM_HEADER_LENGTH))
+    {
+      this->sendBinaryData(frame, length);
+      length = PARAM_HEADER_LENGTH;
     }
   }
-  // Copy result
-  // if ((end - start + 2) > sizeof(result)) { // '\0' takes up one byte
-  //   end = start + sizeof(result) -1;
-  // }
+#endif
+}
 
-  for (i = start, j = 0; i < end; i++, j++)
+#if defined(AI_CAM_EEPROM) && PARAM_SLOT_COUNT > 0
+/**
+ * @brief Write an EEPROM byte only if it differs, to spare write cycles
+ */
+static void eepromUpdate(int address, uint8_t value)
+{
+  if (EEPROM.read(address) != value)
   {
-    result[j] = str[i];
+    EEPROM.write(address, value);
   }
-  result[j] = '\0';
 }
+#endif
 
 /**
- * @brief split by divider, filling the value to a position in the string
+ * @brief Restore the parameters saved by paramSave(). Records are matched
+ *        by id and type, so parameters can be added or removed later
  *
- * @param str string pointer to be operated
- * @param index which index do you wish to return
- * @param value the value to be filled
- * @param divider
+ * @return false if nothing was saved at paramAddress
  */
-void AiCamera::setStrOf(char *str, uint8_t index, String value, char divider)
+bool AiCamera::paramLoad()
 {
-  uint8_t start, end;
-  uint8_t length = strlen(str);
-  uint8_t i, j;
-  // Get start index
-  if (index == 0)
+#ifdef AI_CAM_EEPROM
+#if defined(ESP32) || defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)
+  EEPROM.begin(paramAddress + PARAM_EEPROM_SIZE);
+#endif
+  int address = paramAddress;
+  if (EEPROM.read(address++) != PARAM_EEPROM_MAGIC)
   {
-    start = 0;
+    return false;
   }
-  else
+  uint8_t count = EEPROM.read(address++);
+  if (count > PARAM_SLOT_COUNT)
   {
-    for (start = 0, j = 1; start < length; start++)
-    {
-      if (str[start] == divider)
-      {
-        if (index == j)
-        {
-          start++;
-          break;
-        }
-        j++;
-      }
-    }
+    count = PARAM_SLOT_COUNT;
   }
-  // Get end index
-  for (end = start, j = 0; end < length; end++)
+  for (uint8_t i = 0; i < count; i++, address += PARAM_RECORD_LENGTH)
   {
-    if (str[end] == divider)
+    AiCameraParam *param = getParam(EEPROM.read(address));
+    if (param == NULL || param->type != EEPROM.read(address + 1))
     {
-      break;
+      continue;
+    }
+    int32_t raw = 0;
+    for (uint8_t j = 0; j < 4; j++)
+    {
+      raw |= (uint32_t)EEPROM.read(address + 2 + j) << (8 * j);
+    }
+    if (this->paramSet(param, raw))
+    {
+      this->paramTouch(param);
     }
   }
-  String strString = str;
-  String strValue = strString.substring(0, start) + value + strString.substring(end);
-  strcpy(str, strValue.c_str());
+  return true;
+#else
+  return false;
+#endif
 }
 
 /**
- * @brief Split the string by a cdivider,
- *         and return characters of the selected index.
- *         Further, the content is converted to int type.
- *
- * @param buf string pointer to be split
- * @param index which index do you wish to return
- * @param divider
+ * @brief Save all parameters to EEPROM at paramAddress
  */
-int16_t AiCamera::getIntOf(char *str, uint8_t index, char divider)
+void AiCamera::paramSave()
 {
-  int16_t result;
-  char strResult[20];
-  getStrOf(str, index, strResult, divider);
-  result = String(strResult).toInt();
-  return result;
+  paramSavePending = false;
+#if defined(AI_CAM_EEPROM) && PARAM_SLOT_COUNT > 0
+  int address = paramAddress;
+  eepromUpdate(address++, PARAM_EEPROM_MAGIC);
+  eepromUpdate(address++, paramCount);
+  for (uint8_t i = 0; i < paramCount; i++)
+  {
+    int32_t raw = this->paramGet(&params[i]);
+    eepromUpdate(address++, params[i].id);
+    eepromUpdate(address++, params[i].type);
+    for (uint8_t j = 0; j < 4; j++)
+    {
+      eepromUpdate(address++, (uint8_t)(raw >> (8 * j)));
+    }
+  }
+#if defined(ESP32) || defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)
+  EEPROM.commit();
+#endif
+#endif
 }
 
-bool AiCamera::getBoolOf(char *str, uint8_t index)
+/**
+ * @brief Print the RAM used by the library to DebugSerial
+ */
+void AiCamera::printMemoryReport()
 {
-  char strResult[20];
-  getStrOf(str, index, strResult, ';');
-  return String(strResult).toInt();
+  DebugSerial.print(F("AiCamera static RAM: "));
+  DebugSerial.println((uint16_t)AI_CAM_STATIC_RAM);
+  DebugSerial.print(F("  recvBuffer: "));
+  DebugSerial.println((uint16_t)sizeof(recvBuffer));
+  DebugSerial.print(F("  sendDoc: "));
+  DebugSerial.println((uint16_t)sizeof(sendDoc));
+  DebugSerial.print(F("  globals: "));
+  DebugSerial.println((uint16_t)AI_CAM_GLOBAL_RAM);
+  DebugSerial.print(F("  stack peak: "));
+  DebugSerial.println(stackPeak());
 }
 
-double AiCamera::getDoubleOf(char *str, uint8_t index)
-{
-  double result;
-  char strResult[20];
-  getStrOf(str, index, strResult, ';');
-  result = String(strResult).toDouble();
-  return result;
-}
+/**
+ * @brief Fill the free stack with a canary pattern (AVR only), to measure
+ *        the stack depth of the following calls with stackPeak()
+ *
+ * @code {.cpp}
+ * AiCamera::stackPaint();
+ * aiCam.getJoystick(REGION_K, JOYSTICK_X);
+ * Serial.println(AiCamera::stackPeak()); // bytes used by getJoystick
+ * @endcode
+ */
+#if defined(__AVR__)
+#define STACK_CANARY 0xC5
+static uint8_t *stackBase = NULL;
 
-void AiCamera::lamp_on(uint8_t level)
+void AiCamera::stackPaint()
 {
-  set("LAMP", (char *)String(level).c_str(), false);
+  uint8_t marker;
+  uint8_t *p = (uint8_t *)(__brkval == 0 ? &__heap_start : __brkval);
+  // keep some room for the frame of this function
+  uint8_t *end = &marker - 32;
+  while (p < end)
+  {
+    *p++ = STACK_CANARY;
+  }
+  stackBase = &marker;
 }
 
-void AiCamera::lamp_off(void)
+/**
+ * @brief Deepest stack use since stackPaint(), in bytes below the caller of stackPaint()
+ */
+uint16_t AiCamera::stackPeak()
 {
-  set("LAMP", "0", false);
+  uint8_t *p = (uint8_t *)(__brkval == 0 ? &__heap_start : __brkval);
+  if (stackBase == NULL)
+  {
+    return 0;
+  }
+  while (p < stackBase && *p == STACK_CANARY)
+  {
+    p++;
+  }
+  return stackBase - p;
 }
+#else
+void AiCamera::stackPaint() {}
+uint16_t AiCamera::stackPeak() { return 0; }
+#endif
 
 /**
  * @brief Check the firmware version of the camera
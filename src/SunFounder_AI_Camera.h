@@ -4,12 +4,17 @@
 #include <Arduino.h>
 #include <string.h>
 #include <ArduinoJson.h>
+#include "SunFounder_AI_Camera_Delta.h"
 
 /**
  * Use custom serial port
  */
 // #define AI_CAM_DEBUG_CUSTOM
-#ifdef ARDUINO_MINIMA
+#if defined(__linux__)
+#include "SunFounder_AI_Camera_Linux.h"
+#define DataSerial CameraSerial
+#define DebugSerial Serial
+#elif defined(ARDUINO_MINIMA)
 #define DataSerial Serial1
 #define DebugSerial Serial
 #else
@@ -18,11 +23,25 @@
 #endif
 
 /**
- *  Set SERIAL_TIMEOUT & WS_BUFFER_SIZE
+ *  Set SERIAL_TIMEOUT & buffer sizes.
+ *  Buffer sizes can be overridden with build flags to save RAM,
+ *  e.g. -DWS_BUFFER_SIZE=120 -DSEND_DOC_SIZE=128
  */
 #define SERIAL_TIMEOUT 100
-#define WS_BUFFER_SIZE 200
 #define CHAR_TIMEOUT 50
+#ifndef WS_BUFFER_SIZE
+#define WS_BUFFER_SIZE 200 // receive buffer, at most 255
+#endif
+#ifndef SEND_DOC_SIZE
+#define SEND_DOC_SIZE 200 // sendDoc capacity
+#endif
+#ifndef NAME_SIZE
+#define NAME_SIZE 25 // device name and type, including '\0'
+#endif
+#ifndef VALUE_SIZE
+#define VALUE_SIZE 20 // value of one region, e.g. a joystick "x,y"
+#endif
+#define REPLY_SIZE 25 // reply to a command, e.g. the firmware version or IP
 
 /**
  * Some keywords for communication with ESP32-CAM
@@ -41,9 +60,174 @@
  * Binary data defines
  */
 #define WS_BIN_HEADER_LENGTH 4
+// WS_BIN_HEADER, start, length, checksum and end byte, read into WS_BUFFER_SIZE with the payload
+#define WS_BIN_FRAME_OVERHEAD (WS_BIN_HEADER_LENGTH + 4)
+#define WS_BIN_PAYLOAD_SIZE (WS_BUFFER_SIZE - WS_BIN_FRAME_OVERHEAD)
 #define BIN_START_BYTE 0xA0
 #define BIN_END_BYTE 0xA1
 
+/**
+ * @name Binary message types, the first byte of a WSB+ payload.
+ *       Types below BIN_TYPE_USER are used by the library.
+ *       No setBinaryHandler() routes on AVR to save RAM,
+ *       set BIN_HANDLER_COUNT to use them there
+ */
+#define BIN_TYPE_USER 0x10
+#ifndef BIN_HANDLER_COUNT
+#if defined(__AVR__)
+#define BIN_HANDLER_COUNT 0
+#else
+#define BIN_HANDLER_COUNT 4
+#endif
+#endif
+
+/**
+ * @name Vision results from ESP32-CAM, carried on the WSB+ channel
+ *
+ * Payload: AiCameraVisionHeader followed by `count` AiCameraDetection records
+ */
+#define BIN_TYPE_VISION 0x01
+
+#define VISION_OBJECT 0
+#define VISION_COLOR 1
+#define VISION_LINE 2
+#define VISION_FACE 3
+#define VISION_QR 4
+
+#define VISION_MASK(type) (1 << (type))
+#define VISION_ALL 0xFF
+
+/**
+ * @name Bulk transfer over the WSB+ channel
+ *
+ * Chunk: type BIN_TYPE_BULK, transfer id, sequence (uint16), chunk count (uint16), data
+ * Ack from ESP32-CAM: type BIN_TYPE_BULK_ACK, transfer id, next expected sequence (uint16)
+ * Left out on AVR to save RAM, set BULK_TRANSFER to 1 to keep it
+ */
+#ifndef BULK_TRANSFER
+#if defined(__AVR__)
+#define BULK_TRANSFER 0
+#else
+#define BULK_TRANSFER 1
+#endif
+#endif
+#define BIN_TYPE_BULK 0x02
+#define BIN_TYPE_BULK_ACK 0x03
+#define BULK_HEADER_LENGTH 6
+#ifndef BULK_CHUNK_SIZE
+#define BULK_CHUNK_SIZE 48 // a whole chunk frame fits the 64 byte AVR TX buffer
+#endif
+#ifndef BULK_WINDOW
+#define BULK_WINDOW 4
+#endif
+#define BULK_TIMEOUT 300
+#define BULK_RETRY_COUNT 5
+#ifndef BULK_LINE_RATE
+#define BULK_LINE_RATE 11520 // bytes per second, 115200 baud with 10 bits per byte
+#endif
+
+#define BULK_FRAME_LENGTH (WS_BIN_HEADER_LENGTH + BULK_HEADER_LENGTH + BULK_CHUNK_SIZE + 1)
+
+#define BULK_IDLE 0
+#define BULK_BUSY 1
+#define BULK_DONE 2
+#define BULK_FAILED 3
+
+/**
+ * @name Adaptive telemetry rate, link round trip measured with ping / pong
+ *
+ * Ping to ESP32-CAM: type BIN_TYPE_PING, millis() (uint32)
+ * Pong from ESP32-CAM: type BIN_TYPE_PONG, the same millis() echoed
+ * Left out on AVR to save RAM, set RATE_CONTROL to 1 to keep it
+ */
+#ifndef RATE_CONTROL
+#if defined(__AVR__)
+#define RATE_CONTROL 0
+#else
+#define RATE_CONTROL 1
+#endif
+#endif
+#define BIN_TYPE_PING 0x06
+#define BIN_TYPE_PONG 0x07
+#define RATE_PING_INTERVAL 1000
+#define RATE_RTT_LIMIT 200
+#define RATE_STEP 10
+
+/**
+ * @name JPEG snapshot over the WSB+ channel, requested with SET+SNAP
+ *
+ * Chunk from ESP32-CAM: type BIN_TYPE_SNAPSHOT, snapshot id, sequence (uint16),
+ * JPEG size (uint32), data
+ * Ack to ESP32-CAM: type BIN_TYPE_SNAPSHOT_ACK, snapshot id, next expected sequence (uint16),
+ * SNAPSHOT_CANCEL to stop
+ * Left out on AVR to save RAM, set SNAPSHOT_TRANSFER to 1 to keep it
+ */
+#ifndef SNAPSHOT_TRANSFER
+#if defined(__AVR__)
+#define SNAPSHOT_TRANSFER 0
+#else
+#define SNAPSHOT_TRANSFER 1
+#endif
+#endif
+#define BIN_TYPE_SNAPSHOT 0x04
+#define BIN_TYPE_SNAPSHOT_ACK 0x05
+#define SNAPSHOT_HEADER_LENGTH 8
+#define SNAPSHOT_CHUNK_SIZE (WS_BIN_PAYLOAD_SIZE - SNAPSHOT_HEADER_LENGTH)
+#define SNAPSHOT_CANCEL 0xFFFF
+#define SNAPSHOT_TIMEOUT 1000
+#define SNAPSHOT_RETRY_COUNT 3
+
+#define SNAPSHOT_IDLE 0
+#define SNAPSHOT_BUSY 1
+#define SNAPSHOT_DONE 2
+#define SNAPSHOT_FAILED 3
+
+/**
+ * @name Parameter table synced with the app over the WSB+ channel
+ *
+ * Both ways: type BIN_TYPE_PARAM, table version (uint16), records of
+ * id, PARAM_* type, value (int32, or float bits). From the app the version
+ * is the last one it got, and every parameter changed since is sent back
+ * Info request from the app: type BIN_TYPE_PARAM_INFO
+ * Info reply, one per parameter: type BIN_TYPE_PARAM_INFO, id, PARAM_* type,
+ * min and max (int32, or float bits like the value), name
+ */
+#define BIN_TYPE_PARAM 0x09
+#define BIN_TYPE_PARAM_INFO 0x0A
+#define PARAM_HEADER_LENGTH 3
+#define PARAM_RECORD_LENGTH 6
+#define PARAM_INFO_LENGTH 11
+#ifndef PARAM_SLOT_COUNT
+#if defined(__AVR__)
+#define PARAM_SLOT_COUNT 0 // set it to use the table on AVR, 17 bytes each
+#else
+#define PARAM_SLOT_COUNT 8
+#endif
+#endif
+#define PARAM_FRAME_RECORDS 8
+#define PARAM_NAME_SIZE 16
+#define PARAM_SAVE_DELAY 2000 // EEPROM written once changes settle
+#define PARAM_EEPROM_MAGIC 0xA5
+#define PARAM_EEPROM_SIZE (2 + PARAM_SLOT_COUNT * PARAM_RECORD_LENGTH)
+
+#define PARAM_INT16 0
+#define PARAM_INT32 1
+#define PARAM_FLOAT 2
+#define PARAM_BOOL 3
+
+/**
+ * @name Parameters survive resets where the core has an EEPROM library.
+ *       The Arduino IDE only puts EEPROM.h on the include path of the
+ *       library if the sketch includes it, so include <EEPROM.h> in the
+ *       sketch before this header, or define AI_CAM_EEPROM with a build flag.
+ *       Define AI_CAM_NO_EEPROM to leave it out
+ */
+#if !defined(AI_CAM_EEPROM) && !defined(AI_CAM_NO_EEPROM) && defined(__has_include)
+#if __has_include(<EEPROM.h>)
+#define AI_CAM_EEPROM
+#endif
+#endif
+
 /**
  * @name Set the print level of information received by esp32-cam
  *
@@ -117,6 +301,287 @@
 #define WS_BUFFER_TYPE_TEXT 1
 #define WS_BUFFER_TYPE_BINARY 2
 
+/**
+ * Re-provisioning after ESP32-CAM reboot
+ */
+#define PROVISION_IDLE 0
+#define PROVISION_SETTLE 1
+#define PROVISION_RUN 2
+#define PROVISION_SETTLE_TIME 1000
+#define PROVISION_TIMEOUT 1000
+#define PROVISION_START_TIMEOUT 10000
+#define PROVISION_RETRY_COUNT 3
+#define PROVISION_BACKOFF_MAX 30000
+
+/**
+ * @name TX priority lanes
+ *
+ * Urgent: sendData(), sendBinaryData() and SET+ commands, written at once
+ * Bulk: sendBulk() chunks, paced by loop() so urgent frames go out between them
+ * Their statistics are left out on AVR to save RAM, set TX_LANE_STATS to 1 to keep them
+ */
+#define TX_LANE_URGENT 0
+#define TX_LANE_BULK 1
+#define TX_LANE_COUNT 2
+#ifndef TX_LANE_STATS
+#if defined(__AVR__)
+#define TX_LANE_STATS 0
+#else
+#define TX_LANE_STATS 1
+#endif
+#endif
+
+/**
+ * @name Aggregating telemetry slots, statistic sent for a region
+ *       over each sendData() window. None on AVR to save RAM,
+ *       set AGG_SLOT_COUNT to use them there
+ */
+#define AGG_LAST 0
+#define AGG_MIN 1
+#define AGG_MAX 2
+#define AGG_MEAN 3
+#define AGG_COUNT 4
+#ifndef AGG_SLOT_COUNT
+#if defined(__AVR__)
+#define AGG_SLOT_COUNT 0
+#else
+#define AGG_SLOT_COUNT 4
+#endif
+#endif
+
+/**
+ * @name Per-region telemetry rates. None on AVR to save RAM,
+ *       set RATE_SLOT_COUNT to use them there
+ */
+#ifndef RATE_SLOT_COUNT
+#if defined(__AVR__)
+#define RATE_SLOT_COUNT 0
+#else
+#define RATE_SLOT_COUNT 4
+#endif
+#endif
+#define REGION_ALL_MASK 0x03FFFFFFUL
+
+/**
+ * @name Control input age, inputAge() and setFailsafe() on any WS+ frame
+ *       instead of a single region. Ages per region take 104 bytes and are
+ *       left out on AVR, set INPUT_REGION_AGE to 1 to keep them
+ */
+#define INPUT_ANY 0xFF
+#ifndef INPUT_REGION_AGE
+#if defined(__AVR__)
+#define INPUT_REGION_AGE 0
+#else
+#define INPUT_REGION_AGE 1
+#endif
+#endif
+
+/**
+ * @name Task mode: a dedicated task or core runs the serial pump. It costs
+ *       about 1.1 KB per AiCamera, so it is only built in by default where
+ *       startTask() creates the task (ESP32, Linux), define AI_CAM_NO_TASK to
+ *       leave it out there. Elsewhere define AI_CAM_TASK to build it in, e.g.
+ *       on RP2040 to call pump() from loop1()
+ */
+#if !defined(AI_CAM_TASK) && !defined(AI_CAM_NO_TASK) && (defined(ESP32) || defined(__linux__))
+#define AI_CAM_TASK
+#endif
+#if defined(AI_CAM_TASK) && !(defined(ESP32) || defined(ARDUINO_ARCH_RP2040) || defined(__linux__))
+#error "Task mode needs ESP32, RP2040 or Linux, where the pump task can be told apart"
+#endif
+#ifndef TX_QUEUE_SIZE
+#define TX_QUEUE_SIZE 512
+#endif
+#define TX_QUEUE_FRAME_HEADER 6
+#define PUMP_TASK_STACK 4096
+
+/**
+ * @name Video stream settings, frame sizes follow the esp32-camera framesize_t
+ */
+#define CAM_FRAMESIZE_96X96 0
+#define CAM_FRAMESIZE_QQVGA 1
+#define CAM_FRAMESIZE_QCIF 2
+#define CAM_FRAMESIZE_HQVGA 3
+#define CAM_FRAMESIZE_240X240 4
+#define CAM_FRAMESIZE_QVGA 5
+#define CAM_FRAMESIZE_CIF 6
+#define CAM_FRAMESIZE_HVGA 7
+#define CAM_FRAMESIZE_VGA 8
+#define CAM_FRAMESIZE_SVGA 9
+#define CAM_FRAMESIZE_XGA 10
+#define CAM_FRAMESIZE_HD 11
+
+#define CAM_QUALITY_BEST 10
+#define CAM_QUALITY_DEFAULT 12
+#define CAM_QUALITY_WORST 63
+
+// returned by getFrameSize() and getQuality() before they are set
+#define CAM_VIDEO_UNSET 0xFF
+#define VIDEO_QUALITY_STEP 8
+#define VIDEO_ADAPT_INTERVAL 1000
+#define VIDEO_RECOVER_TIME 5000
+
+/**
+ * Adaptive video quality, setVideoAdaptive(). Left out on AVR to save RAM,
+ * set VIDEO_ADAPTIVE to 1 to keep it
+ */
+#ifndef VIDEO_ADAPTIVE
+#if defined(__AVR__)
+#define VIDEO_ADAPTIVE 0
+#else
+#define VIDEO_ADAPTIVE 1
+#endif
+#endif
+
+/**
+ * Video and vision settings, in the order they are replayed after an ESP32-CAM reboot
+ */
+#define VIDEO_SETTING_FRAMESIZE 0
+#define VIDEO_SETTING_QUALITY 1
+#define VIDEO_SETTING_FPS 2
+#define VIDEO_SETTING_STREAM 3
+#define VIDEO_SETTING_VISION 4
+#define VIDEO_SETTING_LAMP 5
+#define VIDEO_SETTING_COUNT 6
+
+/**
+ * Tickless idle, returned by getNextDeadline() if nothing is scheduled
+ */
+#define IDLE_FOREVER 0xFFFFFFFF
+
+/**
+ * @brief Handler of a binary message type, `data` points into recvBuffer
+ *        right after the type byte and is valid until the next loop()
+ */
+typedef void (*AiCameraBinaryHandler)(const uint8_t *data, size_t len, void *ctx);
+
+struct AiCameraBinaryRoute
+{
+  uint8_t type;
+  AiCameraBinaryHandler handler;
+  void *ctx;
+};
+
+/**
+ * @brief TX statistics of a priority lane, latencies in us
+ */
+struct AiCameraLaneStats
+{
+  uint32_t frames;
+  uint32_t totalLatency;
+  uint32_t maxLatency;
+};
+
+/**
+ * @brief Samples of a region since the last sendData()
+ */
+struct AiCameraAggregate
+{
+  uint8_t region;
+  uint8_t mode;
+  uint16_t divider;
+  uint16_t count;
+  int32_t last;
+  int32_t min;
+  int32_t max;
+  int64_t sum; // 65535 samples of any int32_t fit
+};
+
+/**
+ * @brief Send period of a region
+ */
+struct AiCameraRate
+{
+  uint8_t region;
+  uint16_t interval;
+  uint16_t jitter;
+  uint32_t nextTime;
+};
+
+/**
+ * @brief Tunable parameter, stored by the sketch
+ */
+struct AiCameraParam
+{
+  uint8_t id;
+  uint8_t type;
+  bool dirty;
+  uint16_t version;
+  const char *name;
+  void *value;
+  int32_t min; // range like the value in records: int32, or float bits
+  int32_t max;
+};
+
+/**
+ * @brief Packed records, read in place from recvBuffer (little endian)
+ */
+struct __attribute__((packed)) AiCameraVisionHeader
+{
+  uint8_t msgType;    // BIN_TYPE_VISION
+  uint16_t frameId;   // id of the camera frame the results belong to
+  uint32_t timestamp; // camera time of the frame in ms
+  uint8_t count;      // number of AiCameraDetection records that follow
+};
+
+struct __attribute__((packed)) AiCameraDetection
+{
+  uint8_t type;       // VISION_OBJECT, VISION_COLOR, VISION_LINE ...
+  uint8_t id;         // object class, color or line id
+  uint8_t confidence; // 0 - 255
+  uint8_t reserved;
+  int16_t x;          // box center, or line position
+  int16_t y;
+  uint16_t width;     // box size, or line angle in width
+  uint16_t height;
+};
+
+#ifdef AI_CAM_TASK
+/**
+ * @brief Seqlock'd double buffer handing the latest control frame
+ *        from the pump task to the app, single producer and consumer
+ */
+class AiCameraSnapshot
+{
+public:
+  void write(const char *data);
+  bool read(char *data, uint32_t *lastSeq);
+  bool changed(uint32_t lastSeq);
+
+private:
+  uint32_t seq = 0;
+  char buffer[2][WS_BUFFER_SIZE];
+};
+
+/**
+ * @brief Lock-free single producer, single consumer byte queue carrying
+ *        whole frames between the app and the pump task. Each frame starts
+ *        with a header holding its length and micros() of begin()
+ */
+class AiCameraFrameQueue : public Print
+{
+public:
+  uint16_t dropped = 0;
+
+  void begin();
+  size_t write(uint8_t c);
+  using Print::write;
+  bool commit();
+  bool isEmpty();
+  uint16_t used();
+  bool next(uint16_t *length, uint32_t *since);
+  size_t read(uint8_t *data, size_t size);
+
+private:
+  uint8_t buffer[TX_QUEUE_SIZE];
+  uint16_t head = 0;
+  uint16_t tail = 0;
+  uint16_t pending = 0;
+  uint32_t stamp = 0;
+  bool overflow = false;
+};
+#endif
+
 class AiCamera
 {
 public:
@@ -124,7 +589,7 @@ public:
   uint8_t recvBuffer[WS_BUFFER_SIZE];
   uint8_t recvBufferType = WS_BUFFER_TYPE_TEXT;
   uint8_t recvBufferLength = 0;
-  StaticJsonDocument<200> sendDoc;
+  StaticJsonDocument<SEND_DOC_SIZE> sendDoc;
 
   AiCamera(const char *name, const char *type);
   void begin(const char *ssid, const char *password, const char *wsPort = "8765", bool autoSend = true);
@@ -132,8 +597,15 @@ public:
 
   void setOnReceived(void (*func)());
   void setOnReceivedBinary(void (*func)());
+  void setOnIdle(void (*func)(uint32_t timeout));
+  void setOnVision(void (*func)());
+  bool setBinaryHandler(uint8_t type, AiCameraBinaryHandler handler, void *ctx = NULL);
+  uint16_t getDroppedBinary();
+  uint16_t getDroppedTx();
   void setCommandTimeout(uint32_t _timeout);
   void loop();
+  void pump();
+  bool startTask();
 
   void sendData();
   void sendBinaryData(uint8_t *data, size_t len);
@@ -144,31 +616,280 @@ public:
   int16_t getJoystick(uint8_t region, uint8_t axis);
   uint8_t getDPad(uint8_t region);
   int16_t getThrottle(uint8_t region);
-  void getSpeech(uint8_t region, char *result);
+  void getSpeech(uint8_t region, char *result, uint8_t size = VALUE_SIZE);
 
   void setMeter(uint8_t region, double value);
   void setRadar(uint8_t region, int16_t angle, double distance);
   void setGreyscale(uint8_t region, uint16_t value1, uint16_t value2, uint16_t value3);
   void setValue(uint8_t region, double value);
 
+  bool setAggregate(uint8_t region, uint8_t mode, uint16_t divider = 1);
+  void addSample(uint8_t region, int32_t value);
+
+  bool setSendInterval(uint8_t region, uint16_t interval, uint16_t jitter = 0);
+
+  bool addParam(uint8_t id, const char *name, int16_t *value, int16_t min, int16_t max);
+  bool addParam(uint8_t id, const char *name, int32_t *value, int32_t min, int32_t max);
+  bool addParam(uint8_t id, const char *name, float *value, float min, float max);
+  bool addParam(uint8_t id, const char *name, bool *value);
+  void paramChanged(uint8_t id);
+  uint16_t getParamVersion();
+  void setOnParam(void (*func)(uint8_t id));
+  bool setParamStorage(int address = 0);
+
+  uint32_t inputAge(uint8_t region = INPUT_ANY);
+  bool setFailsafe(uint16_t timeout, void (*func)(), uint8_t region = INPUT_ANY);
+  bool isFailsafe();
+
   void lamp_on(uint8_t level = 5);
   void lamp_off(void);
 
+  void setFrameSize(uint8_t frameSize);
+  void setQuality(uint8_t quality);
+  void setFrameRate(uint8_t fps);
+  void stream_on(void);
+  void stream_off(void);
+  void setVideoAdaptive(bool enable, uint8_t minFrameSize = CAM_FRAMESIZE_QQVGA, uint8_t maxQuality = 40);
+  void reportCongestion(void);
+  uint8_t getFrameSize();
+  uint8_t getQuality();
+
+  void subscribeVision(uint8_t mask);
+  const AiCameraVisionHeader *getVision();
+  const AiCameraDetection *getDetections();
+
+  bool sendBulk(uint32_t length, size_t (*producer)(uint32_t offset, uint8_t *buffer, size_t size));
+  uint8_t getBulkState();
+  uint32_t getBulkThroughput();
+  uint8_t getBulkEfficiency();
+
+  bool takeSnapshot(uint8_t frameSize, uint8_t quality, bool (*sink)(uint32_t offset, const uint8_t *data, size_t size));
+  uint8_t getSnapshotState();
+  uint32_t getSnapshotSize();
+  float getSnapshotThroughput();
+
+  const AiCameraLaneStats *getLaneStats(uint8_t lane);
+  void resetLaneStats();
+
+  void printMemoryReport();
+  static void stackPaint();
+  static uint16_t stackPeak();
+
   void reset(bool wait = true);
 
+  void setSendRate(uint16_t minInterval, uint16_t maxInterval);
+  uint16_t getSendInterval();
+  uint16_t getLinkRtt();
+
+  bool isProvisioning();
+  uint32_t getRecoveryTime();
+  uint16_t getRecoveryCount();
+
+  uint32_t getNextDeadline();
+  void idle(uint32_t maxTime = IDLE_FOREVER);
+  uint32_t getIdleTime();
+
 private:
   bool autoSend = true;
-  void readInto(char *buffer);
+
+  const char *ssid = NULL;
+  const char *password = NULL;
+  const char *wifiMode = NULL;
+  const char *wsPort = NULL;
+  bool provisioned = false;
+  uint8_t provisionState = PROVISION_IDLE;
+  uint8_t provisionStep = 0;
+  uint8_t provisionRetry = 0;
+  uint8_t provisionVideo = 0;
+  uint8_t provisionPending = 0;
+  uint16_t provisionDelay = PROVISION_SETTLE_TIME;
+  uint32_t provisionTime = 0;
+  uint32_t rebootTime = 0;
+  uint32_t recoveryTime = 0;
+  uint16_t recoveryCount = 0;
+  uint32_t idleTime = 0;
+
+  uint8_t videoFrameSize = CAM_VIDEO_UNSET;
+  uint8_t videoQuality = CAM_VIDEO_UNSET;
+  uint8_t videoFrameRate = 0;
+  uint8_t videoStream = 0;
+  uint8_t visionMask = 0;
+  uint8_t lampLevel = 0;
+  // bit n set once VIDEO_SETTING_n was set, every value is valid
+  uint8_t videoSettings = 0;
+  uint8_t adaptFrameSize = CAM_VIDEO_UNSET;
+  uint8_t adaptQuality = CAM_VIDEO_UNSET;
+#if VIDEO_ADAPTIVE
+  bool videoAdaptive = false;
+  uint8_t videoMinFrameSize = CAM_FRAMESIZE_QQVGA;
+  uint8_t videoMaxQuality = 40;
+  uint32_t adaptTime = 0;
+  uint32_t congestionTime = 0;
+#endif
+
+#if BULK_TRANSFER
+  uint8_t bulkState = BULK_IDLE;
+  uint8_t bulkId = 0;
+  uint8_t bulkRetry = 0;
+  uint32_t bulkLength = 0;
+  uint16_t bulkChunks = 0;
+  uint16_t bulkBase = 0;
+  uint16_t bulkNext = 0;
+  uint32_t bulkTime = 0;
+  uint32_t bulkStartTime = 0;
+  uint32_t bulkThroughput = 0;
+  uint32_t bulkReadyTime = 0;
+  uint32_t bulkTxTime = 0;
+#endif
+
+#if SNAPSHOT_TRANSFER
+  uint8_t snapState = SNAPSHOT_IDLE;
+  uint8_t snapId = 0;
+  uint8_t snapRetry = 0;
+  uint16_t snapSeq = 0;
+  uint32_t snapSize = 0;
+  uint32_t snapReceived = 0;
+  uint32_t snapStartTime = 0;
+  uint32_t snapTime = 0;
+#endif
+
+#if TX_LANE_STATS
+  AiCameraLaneStats laneStats[TX_LANE_COUNT] = {};
+#endif
+  uint16_t droppedTx = 0;
+
+  uint8_t aggCount = 0;
+#if AGG_SLOT_COUNT > 0
+  AiCameraAggregate aggSlots[AGG_SLOT_COUNT];
+#endif
+
+  uint8_t rateCount = 0;
+#if RATE_SLOT_COUNT > 0
+  AiCameraRate rateSlots[RATE_SLOT_COUNT];
+#endif
+
+  uint8_t routeCount = 0;
+  uint16_t droppedBinary = 0;
+
+  // readInto() state of the frame being received
+  uint16_t rxCount = 0;
+  bool rxBinary = false;
+  uint8_t rxBinaryByteCount = 0;
+  uint8_t rxBinaryLength = 0;
+  uint8_t rxBinaryChecksum = 0;
+  uint32_t rxTime = 0;
+#if BIN_HANDLER_COUNT > 0
+  AiCameraBinaryRoute routes[BIN_HANDLER_COUNT];
+#endif
+
+#if RATE_CONTROL
+  bool rateControl = false;
+  bool pongSeen = false;
+  uint16_t rateMin = 0;
+  uint16_t rateMax = 0;
+  uint16_t linkRtt = 0;
+  uint32_t pingTime = 0;
+  uint32_t pongTime = 0;
+  uint32_t telemetryWriteTime = 0;
+#endif
+
+  uint8_t paramCount = 0;
+  uint16_t paramVersion = 0;
+  bool paramDirty = false;
+  bool paramSavePending = false;
+  int paramAddress = -1;
+  uint32_t paramSaveTime = 0;
+#if PARAM_SLOT_COUNT > 0
+  AiCameraParam params[PARAM_SLOT_COUNT];
+#endif
+
+  uint32_t inputTime = 0;
+#if INPUT_REGION_AGE
+  uint32_t regionInputTime[REGION_Z + 1] = {};
+#endif
+  uint32_t *failsafeInput = &inputTime;
+  uint16_t failsafeTimeout = 0;
+  bool failsafeActive = false;
+
+  bool taskMode = false;
+#ifdef AI_CAM_TASK
+  uint32_t appSeq = 0;
+  char appBuffer[WS_BUFFER_SIZE];
+  AiCameraSnapshot controlSnapshot;
+  AiCameraFrameQueue txQueue;
+#if PARAM_SLOT_COUNT > 0
+  AiCameraFrameQueue paramQueue;
+#endif
+  uintptr_t pumpContext = UINTPTR_MAX;
+  bool pumpWake = false;
+  static void pumpTask(void *arg);
+#endif
+  bool inPump();
+  bool handedOver();
+  void wakePump();
+  bool pumpWoken();
+
+  bool getProvisionCommand(uint8_t step, const char **command, const char **value);
+  uint8_t getProvisionVideoStep();
+  uint32_t getProvisionTimeout();
+  void provisionSend();
+  void provisionLoop();
+  void provisionAck();
+
+  void sendVideoSetting(uint8_t setting, uint8_t value);
+  void videoLoop();
+  bool isVision();
+
+#if BULK_TRANSFER
+  bool bulkSendChunk(uint16_t seq);
+#endif
+  void bulkLoop();
+  void bulkAck();
+  void snapshotChunk();
+#if SNAPSHOT_TRANSFER
+  void snapshotAck(uint16_t seq);
+#endif
+  void snapshotLoop();
+
+  void autoSendData();
+  void rateUpdate();
+  void pongReset();
+  void pingLoop();
+  void txDone(uint8_t lane, uint32_t since);
+
+  AiCameraAggregate *getAggregate(uint8_t region);
+  void packAggregates(uint32_t dueMask);
+  uint32_t getDueRegions();
+  bool paramAdd(uint8_t id, const char *name, void *value, uint8_t type, int32_t min, int32_t max);
+  AiCameraParam *getParam(uint8_t id);
+  int32_t paramGet(AiCameraParam *param);
+  bool paramSet(AiCameraParam *param, int32_t raw);
+  uint16_t paramTouch(AiCameraParam *param);
+  void paramReceive(const uint8_t *data, uint8_t length);
+  void paramSendInfo();
+  void paramLoop();
+  bool paramLoad();
+  void paramSave();
+  void inputReceived(const char *frame);
+  void failsafeLoop();
+  bool readInto(char *buffer);
+  char *ctrlBuffer();
+  Print &txBegin();
+  void txEnd(uint32_t since);
+  bool txFailed();
+  void writeCommand(Print &out, const char *command, const char *value);
+  void writeCommand(Print &out, const __FlashStringHelper *command, const char *value);
+  void sendCommand(const __FlashStringHelper *command, const char *value);
   void debug(char *msg);
 
-  void command(const char *command, const char *value, char *result, bool wait = true);
+  void command(const char *command, const char *value, char *result, uint8_t size, bool wait = true);
   void set(const char *command, bool wait = true);
   void set(const char *command, const char *value, bool wait = true);
-  void get(const char *command, char *result);
-  void get(const char *command, const char *value, char *result);
+  void get(const char *command, char *result, uint8_t size);
+  void get(const char *command, const char *value, char *result, uint8_t size);
 
   void subString(char *str, int16_t start, int16_t end = -1);
-  void getStrOf(char *str, uint8_t index, char *result, char divider);
+  void getStrOf(char *str, uint8_t index, char *result, char divider, uint8_t size);
   void setStrOf(char *str, uint8_t index, String value, char divider = ';');
   int16_t getIntOf(char *str, uint8_t index, char divider = ';');
   bool getBoolOf(char *str, uint8_t index);
@@ -177,4 +898,46 @@ private:
   bool checkFirmwareVersion(String version);
 };
 
+static_assert(WS_BUFFER_SIZE <= 255, "WS_BUFFER_SIZE must fit the uint8_t binary length");
+static_assert(WS_BIN_PAYLOAD_SIZE >= (int)sizeof(AiCameraVisionHeader), "WS_BUFFER_SIZE is too small for vision results");
+static_assert(SNAPSHOT_CHUNK_SIZE > 0, "WS_BUFFER_SIZE is too small for snapshot chunks");
+
+/**
+ * Static RAM of the library globals: name and type, timers, callbacks,
+ * the re-provisioning value, the all-zero lane statistics (without
+ * TX_LANE_STATS), the aggregate keys (with AGG_SLOT_COUNT), and the stack
+ * marker (AVR) or CameraSerial (Linux). The command tables are in flash.
+ * String literals used without F() are not counted, see
+ * Memory Usage in the README for measuring them with avr-size
+ */
+#define AI_CAM_CALLBACK_COUNT (6 + BULK_TRANSFER + SNAPSHOT_TRANSFER)
+#if defined(__AVR__)
+#define AI_CAM_PLATFORM_RAM sizeof(uint8_t *)
+#elif defined(__linux__)
+#define AI_CAM_PLATFORM_RAM sizeof(AiCameraSerial)
+#else
+#define AI_CAM_PLATFORM_RAM 0
+#endif
+#if TX_LANE_STATS
+#define AI_CAM_LANE_RAM 0
+#else
+#define AI_CAM_LANE_RAM sizeof(AiCameraLaneStats)
+#endif
+#if AGG_SLOT_COUNT > 0
+#define AI_CAM_AGG_RAM (2 * (REGION_Z + 1))
+#else
+#define AI_CAM_AGG_RAM 0
+#endif
+#define AI_CAM_GLOBAL_RAM (2 * NAME_SIZE + 3 * sizeof(int32_t) + AI_CAM_CALLBACK_COUNT * sizeof(void (*)()) + 4 + \
+                           AI_CAM_LANE_RAM + AI_CAM_AGG_RAM + AI_CAM_PLATFORM_RAM)
+
+/**
+ * Static RAM used by the library, an AiCamera object and the globals
+ * Define AI_CAM_RAM_LIMIT to fail the build when it is exceeded
+ */
+#define AI_CAM_STATIC_RAM (sizeof(AiCamera) + AI_CAM_GLOBAL_RAM)
+#ifdef AI_CAM_RAM_LIMIT
+static_assert(AI_CAM_STATIC_RAM <= AI_CAM_RAM_LIMIT, "AiCamera static RAM exceeds AI_CAM_RAM_LIMIT");
+#endif
+
 #endif // __SUNFOUNDER_AI_CAMERA_H__
@@ -0,0 +1,145 @@
+#include "SunFounder_AI_Camera_Delta.h"
+
+/**
+ * @brief Start a new frame
+ *
+ * @param buffer where the frame is written, sent as is with sendBinaryData()
+ * @param size buffer size
+ * @param type message type of the frame, BIN_TYPE_USER and above,
+ *             the one the receiver routes with setBinaryHandler()
+ * @param channels values per sample, up to DELTA_MAX_CHANNELS
+ */
+void AiCameraDeltaEncoder::begin(uint8_t *buffer, size_t size, uint8_t type, uint8_t channels)
+{
+  this->buffer = buffer;
+  this->size = size;
+  this->channels = constrain(channels, 1, DELTA_MAX_CHANNELS);
+  this->samples = 0;
+  this->len = 0;
+  memset(prev, 0, sizeof(prev));
+  if (size >= DELTA_HEADER_LENGTH)
+  {
+    buffer[0] = type;
+    buffer[1] = this->channels;
+    this->len = DELTA_HEADER_LENGTH;
+  }
+}
+
+/**
+ * @brief Add one sample, a value for every channel
+ *
+ * @param sample `channels` values
+ * @return false if the frame is full, the sample is not added
+ */
+bool AiCameraDeltaEncoder::add(const int32_t *sample)
+{
+  size_t start = len;
+  if (len < DELTA_HEADER_LENGTH)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    // wrapping difference, zigzag maps small negatives to small numbers
+    uint32_t delta = (uint32_t)sample[i] - (uint32_t)prev[i];
+    uint32_t zigzag = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+    do
+    {
+      if (len >= size)
+      {
+        len = start;
+        return false;
+      }
+      buffer[len++] = (zigzag & 0x7F) | (zigzag > 0x7F ? 0x80 : 0);
+      zigzag >>= 7;
+    } while (zigzag != 0);
+  }
+  memcpy(prev, sample, channels * sizeof(int32_t));
+  samples++;
+  return true;
+}
+
+/**
+ * @brief Add one sample of a single channel frame
+ */
+bool AiCameraDeltaEncoder::add(int32_t value)
+{
+  return add(&value);
+}
+
+/**
+ * @brief Frame length in bytes
+ */
+size_t AiCameraDeltaEncoder::length()
+{
+  return len;
+}
+
+/**
+ * @brief Samples in the frame
+ */
+uint16_t AiCameraDeltaEncoder::count()
+{
+  return samples;
+}
+
+/**
+ * @brief Start decoding a frame
+ *
+ * @param data the frame after its type byte, starting with the channel
+ *             count, as binary handlers get it
+ * @param len length of data
+ * @return false if it is not a valid frame
+ */
+bool AiCameraDeltaDecoder::begin(const uint8_t *data, size_t len)
+{
+  if (len < 1 || data[0] < 1 || data[0] > DELTA_MAX_CHANNELS)
+  {
+    this->len = 0;
+    return false;
+  }
+  this->channels = data[0];
+  this->data = data;
+  this->len = len;
+  this->pos = 1;
+  memset(prev, 0, sizeof(prev));
+  return true;
+}
+
+/**
+ * @brief Decode the next sample
+ *
+ * @param sample getChannels() values are written
+ * @return false at the end of the frame, or if it is truncated
+ */
+bool AiCameraDeltaDecoder::next(int32_t *sample)
+{
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    uint32_t zigzag = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+    do
+    {
+      if (pos >= len || shift >= 7 * DELTA_MAX_VARINT)
+      {
+        return false;
+      }
+      byte = data[pos++];
+      zigzag |= (uint32_t)(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    uint32_t delta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+    prev[i] = (int32_t)((uint32_t)prev[i] + delta);
+    sample[i] = prev[i];
+  }
+  return channels > 0;
+}
+
+/**
+ * @brief Values per sample of the frame
+ */
+uint8_t AiCameraDeltaDecoder::getChannels()
+{
+  return channels;
+}
@@ -0,0 +1,84 @@
+#ifndef __SUNFOUNDER_AI_CAMERA_DELTA_H__
+#define __SUNFOUNDER_AI_CAMERA_DELTA_H__
+
+#include <Arduino.h>
+
+/**
+ * @name Delta compressed sample frames for the WSB+ channel
+ *
+ * Payload: a message type of the sketch (BIN_TYPE_USER and above), channel
+ * count, then for every sample and channel the zigzag varint of the
+ * difference to the previous sample of that channel. The first sample is
+ * relative to 0, so every frame decodes on its own
+ */
+#define DELTA_HEADER_LENGTH 2
+#ifndef DELTA_MAX_CHANNELS
+#define DELTA_MAX_CHANNELS 4
+#endif
+#define DELTA_MAX_VARINT 5
+
+/**
+ * @brief Pack successive samples into a caller supplied buffer
+ *
+ * @code {.cpp}
+ * #define MSG_IMU (BIN_TYPE_USER + 2)
+ * uint8_t frame[64];
+ * AiCameraDeltaEncoder encoder;
+ * encoder.begin(frame, sizeof(frame), MSG_IMU, 3);
+ * int32_t imu[3] = {ax, ay, az};
+ * if (!encoder.add(imu)) {
+ *   aiCam.sendBinaryData(frame, encoder.length());
+ *   encoder.begin(frame, sizeof(frame), MSG_IMU, 3);
+ *   encoder.add(imu);
+ * }
+ * @endcode
+ */
+class AiCameraDeltaEncoder
+{
+public:
+  void begin(uint8_t *buffer, size_t size, uint8_t type, uint8_t channels = 1);
+  bool add(const int32_t *sample);
+  bool add(int32_t value);
+  size_t length();
+  uint16_t count();
+
+private:
+  uint8_t *buffer = NULL;
+  size_t size = 0;
+  size_t len = 0;
+  uint8_t channels = 1;
+  uint16_t samples = 0;
+  int32_t prev[DELTA_MAX_CHANNELS];
+};
+
+/**
+ * @brief Unpack the samples of a delta frame in the binary handler of its type
+ *
+ * @code {.cpp}
+ * void onDelta(const uint8_t *data, size_t len, void *ctx) {
+ *   AiCameraDeltaDecoder decoder;
+ *   int32_t sample[DELTA_MAX_CHANNELS];
+ *   decoder.begin(data, len);
+ *   while (decoder.next(sample)) {
+ *     ...
+ *   }
+ * }
+ * aiCam.setBinaryHandler(MSG_IMU, onDelta);
+ * @endcode
+ */
+class AiCameraDeltaDecoder
+{
+public:
+  bool begin(const uint8_t *data, size_t len);
+  bool next(int32_t *sample);
+  uint8_t getChannels();
+
+private:
+  const uint8_t *data = NULL;
+  size_t len = 0;
+  size_t pos = 0;
+  uint8_t channels = 0;
+  int32_t prev[DELTA_MAX_CHANNELS];
+};
+
+#endif // __SUNFOUNDER_AI_CAMERA_DELTA_H__
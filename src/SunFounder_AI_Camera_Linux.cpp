@@ -0,0 +1,300 @@
+#if defined(__linux__)
+
+#include "SunFounder_AI_Camera_Linux.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define WRITE_TIMEOUT 1000
+
+AiCameraSerial CameraSerial;
+
+/**
+ * @brief Map a baud rate to the termios speed
+ *
+ * @return B0 if the rate is not supported
+ */
+static speed_t toSpeed(uint32_t baud)
+{
+  switch (baud)
+  {
+  case 9600:
+    return B9600;
+  case 19200:
+    return B19200;
+  case 38400:
+    return B38400;
+  case 57600:
+    return B57600;
+  case 115200:
+    return B115200;
+  case 230400:
+    return B230400;
+  case 460800:
+    return B460800;
+  case 921600:
+    return B921600;
+  default:
+    return B0;
+  }
+}
+
+/**
+ * @brief Open the tty and set it to raw mode
+ *
+ * @param device e.g. "/dev/ttyS0", "/dev/ttyUSB0", or a pty for testing
+ * @param baud baud rate
+ * @return false if the tty can not be opened or set up, or the baud rate
+ *         is not one of 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600
+ */
+bool AiCameraSerial::begin(const char *device, uint32_t baud)
+{
+  struct termios tty;
+  struct epoll_event event = {};
+  speed_t speed = toSpeed(baud);
+
+  end();
+  if (speed == B0)
+  {
+    return false;
+  }
+  ttyFd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (ttyFd < 0)
+  {
+    return false;
+  }
+  if (tcgetattr(ttyFd, &tty) != 0)
+  {
+    end();
+    return false;
+  }
+  cfmakeraw(&tty);
+  tty.c_cflag |= CLOCAL | CREAD;
+  tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 0;
+  cfsetispeed(&tty, speed);
+  cfsetospeed(&tty, speed);
+  if (tcsetattr(ttyFd, TCSANOW, &tty) != 0)
+  {
+    end();
+    return false;
+  }
+  tcflush(ttyFd, TCIOFLUSH);
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  event.events = EPOLLIN;
+  event.data.fd = ttyFd;
+  if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, ttyFd, &event) != 0)
+  {
+    end();
+    return false;
+  }
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  event.data.fd = wakeFd;
+  if (wakeFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) != 0)
+  {
+    end();
+    return false;
+  }
+  head = 0;
+  tail = 0;
+  return true;
+}
+
+void AiCameraSerial::end()
+{
+  if (wakeFd >= 0)
+  {
+    close(wakeFd);
+    wakeFd = -1;
+  }
+  if (epollFd >= 0)
+  {
+    close(epollFd);
+    epollFd = -1;
+  }
+  if (ttyFd >= 0)
+  {
+    close(ttyFd);
+    ttyFd = -1;
+  }
+}
+
+/**
+ * @brief The tty file descriptor, to add to an external event loop
+ *        (epoll, poll, libuv ...). Call aiCam.loop() when it is readable
+ */
+int AiCameraSerial::fd()
+{
+  return ttyFd;
+}
+
+/**
+ * @brief Sleep until data arrives, wake() is called or the timeout expires
+ *
+ * @param timeout in ms
+ * @return true if data is available
+ */
+bool AiCameraSerial::wait(uint32_t timeout)
+{
+  struct epoll_event event;
+  if (head != tail)
+  {
+    return true;
+  }
+  if (epollFd < 0)
+  {
+    delay(timeout);
+    return false;
+  }
+  int ms = timeout > 0x7FFFFFFF ? -1 : (int)timeout;
+  if (epoll_wait(epollFd, &event, 1, ms) <= 0)
+  {
+    return false;
+  }
+  if (event.data.fd == wakeFd)
+  {
+    uint64_t count;
+    ssize_t ignored = ::read(wakeFd, &count, sizeof(count));
+    (void)ignored;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief End a wait() from another thread, e.g. when the app queued
+ *        something for the pump task
+ */
+void AiCameraSerial::wake()
+{
+  uint64_t one = 1;
+  if (wakeFd >= 0)
+  {
+    ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+    (void)ignored;
+  }
+}
+
+/**
+ * @brief Read what the tty has into the buffer, never blocks
+ */
+void AiCameraSerial::fill()
+{
+  if (ttyFd < 0)
+  {
+    return;
+  }
+  // keep one byte free to tell a full buffer from an empty one
+  while ((uint16_t)(head + 1) % CAMERA_SERIAL_BUFFER_SIZE != tail)
+  {
+    uint16_t end = tail > head ? tail - 1 : CAMERA_SERIAL_BUFFER_SIZE - (tail == 0 ? 1 : 0);
+    ssize_t count = ::read(ttyFd, buffer + head, end - head);
+    if (count <= 0)
+    {
+      break;
+    }
+    head = (head + count) % CAMERA_SERIAL_BUFFER_SIZE;
+  }
+}
+
+int AiCameraSerial::available()
+{
+  if (head == tail)
+  {
+    fill();
+  }
+  return (head + CAMERA_SERIAL_BUFFER_SIZE - tail) % CAMERA_SERIAL_BUFFER_SIZE;
+}
+
+int AiCameraSerial::read()
+{
+  if (available() == 0)
+  {
+    return -1;
+  }
+  uint8_t c = buffer[tail];
+  tail = (tail + 1) % CAMERA_SERIAL_BUFFER_SIZE;
+  return c;
+}
+
+int AiCameraSerial::peek()
+{
+  if (available() == 0)
+  {
+    return -1;
+  }
+  return buffer[tail];
+}
+
+/**
+ * @brief Wait until the tty can take more data. Polls the tty alone, so
+ *        wake() does not end the wait
+ *
+ * @param timeout in ms
+ */
+bool AiCameraSerial::waitWritable(uint32_t timeout)
+{
+  struct pollfd out = {ttyFd, POLLOUT, 0};
+  return poll(&out, 1, timeout) > 0;
+}
+
+size_t AiCameraSerial::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+/**
+ * @brief Write all data, waiting while the tty output buffer is full.
+ *        If the tty takes nothing for WRITE_TIMEOUT, the rest is dropped
+ *        and the write error is set, see getWriteError()
+ */
+size_t AiCameraSerial::write(const uint8_t *data, size_t size)
+{
+  size_t written = 0;
+  if (ttyFd < 0)
+  {
+    return 0;
+  }
+  while (written < size)
+  {
+    ssize_t count = ::write(ttyFd, data + written, size - written);
+    if (count > 0)
+    {
+      written += count;
+    }
+    else if (count < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    // nothing taken, or EAGAIN: the output buffer is full
+    else if ((count == 0 || errno == EAGAIN) && waitWritable(WRITE_TIMEOUT))
+    {
+      continue;
+    }
+    else
+    {
+      setWriteError();
+      break;
+    }
+  }
+  return written;
+}
+
+/**
+ * @brief Wait until all data is sent
+ */
+void AiCameraSerial::flush()
+{
+  if (ttyFd >= 0)
+  {
+    tcdrain(ttyFd);
+  }
+}
+
+#endif // __linux__
@@ -0,0 +1,55 @@
+#ifndef __SUNFOUNDER_AI_CAMERA_LINUX_H__
+#define __SUNFOUNDER_AI_CAMERA_LINUX_H__
+
+#if defined(__linux__)
+
+#include <Arduino.h>
+
+#ifndef CAMERA_SERIAL_BUFFER_SIZE
+#define CAMERA_SERIAL_BUFFER_SIZE 256
+#endif
+
+/**
+ * @brief Serial port to ESP32-CAM on Linux boards (Raspberry Pi ...),
+ *        a POSIX tty in raw mode with non-blocking read and write.
+ *        It is the DataSerial on Linux
+ *
+ * @code {.cpp}
+ * CameraSerial.begin("/dev/ttyS0", 115200);
+ * aiCam.begin(SSID, PASSWORD, PORT);
+ * @endcode
+ */
+class AiCameraSerial : public Stream
+{
+public:
+  bool begin(const char *device, uint32_t baud = 115200);
+  void end();
+  int fd();
+  bool wait(uint32_t timeout);
+  void wake();
+
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *data, size_t size);
+  using Print::write;
+  void flush();
+
+private:
+  int ttyFd = -1;
+  int epollFd = -1;
+  int wakeFd = -1;
+  uint8_t buffer[CAMERA_SERIAL_BUFFER_SIZE];
+  uint16_t head = 0;
+  uint16_t tail = 0;
+
+  void fill();
+  bool waitWritable(uint32_t timeout);
+};
+
+extern AiCameraSerial CameraSerial;
+
+#endif // __linux__
+
+#endif // __SUNFOUNDER_AI_CAMERA_LINUX_H__